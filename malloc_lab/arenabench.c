@@ -0,0 +1,202 @@
+/*
+ * arenabench.c - Request scoped benchmark for the region arenas of mm.c
+ *
+ * Every request allocates a number of objects of pseudo random sizes,
+ * links them into a list, walks the list once and lets all of them die
+ * at the end of the request. The same requests are run twice: with one
+ * mm_malloc/mm_free per object and with mm_arena_alloc from one region
+ * that is reset after every request. The benchmark prints the time,
+ * the allocations per second and the peak heap of both and the speedup
+ * of the region.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MAX_SIZE   512  /* largest object in bytes */
+#define BIG_EVERY  64   /* every BIG_EVERY-th object is big ... */
+#define BIG_SIZE   8192 /* ... and up to BIG_SIZE bytes */
+
+static int num_requests = 10000; /* requests (set by -n) */
+static int num_objects = 200;    /* objects per request (set by -k) */
+static size_t block_size = 0;    /* block size of the region (set by -b) */
+
+/* An object of a request, the rest of its bytes is filled */
+typedef struct object {
+    struct object *next;
+    size_t size;
+} object_t;
+
+/* size of the i-th object of a request */
+static size_t object_size(unsigned *seed, int i)
+{
+    *seed = *seed * 1103515245 + 12345;
+    if (i % BIG_EVERY == BIG_EVERY - 1)
+	return sizeof(object_t) + (*seed >> 8) % BIG_SIZE;
+    return sizeof(object_t) + (*seed >> 8) % MAX_SIZE;
+}
+
+/* fill an object and put it in front of the list */
+static object_t *link_object(object_t *head, void *p, size_t size)
+{
+    object_t *obj = p;
+
+    if (obj == NULL) {
+	fprintf(stderr, "allocation failed\n");
+	exit(1);
+    }
+    memset(obj, (int)size, size);
+    obj->next = head;
+    obj->size = size;
+    return obj;
+}
+
+/* walk the list of a request, the sum keeps it from being optimized out */
+static size_t walk(object_t *head)
+{
+    size_t sum = 0;
+
+    for (; head != NULL; head = head->next)
+	sum += head->size + ((unsigned char *)head)[head->size - 1];
+    return sum;
+}
+
+/*
+ * run_malloc - run all requests with one mm_malloc/mm_free per object,
+ *     returns elapsed seconds
+ */
+static double run_malloc(size_t *sum)
+{
+    struct timespec t0, t1;
+    unsigned seed = 1;
+    int r, i;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	fprintf(stderr, "mm_init failed\n");
+	exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (r = 0; r < num_requests; r++) {
+	object_t *head = NULL;
+
+	for (i = 0; i < num_objects; i++) {
+	    size_t size = object_size(&seed, i);
+	    head = link_object(head, mm_malloc(size), size);
+	}
+	*sum += walk(head);
+	while (head != NULL) {
+	    object_t *next = head->next;
+	    mm_free(head);
+	    head = next;
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+ * run_arena - run all requests with one region that is reset after
+ *     every request, returns elapsed seconds
+ */
+static double run_arena(size_t *sum)
+{
+    struct timespec t0, t1;
+    mm_arena_t *region;
+    unsigned seed = 1;
+    int r, i;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	fprintf(stderr, "mm_init failed\n");
+	exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if ((region = mm_arena_create(block_size)) == NULL) {
+	fprintf(stderr, "mm_arena_create failed\n");
+	exit(1);
+    }
+    for (r = 0; r < num_requests; r++) {
+	object_t *head = NULL;
+
+	for (i = 0; i < num_objects; i++) {
+	    size_t size = object_size(&seed, i);
+	    head = link_object(head, mm_arena_alloc(region, size), size);
+	}
+	*sum += walk(head);
+	mm_arena_reset(region);
+    }
+    mm_arena_destroy(region);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: arenabench [-h] [-n <requests>] [-k <objects>] "
+	    "[-b <bytes>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <bytes> Block size of the region (default of mm.c).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-k <num>   Objects per request.\n");
+    fprintf(stderr, "\t-n <num>   Number of requests.\n");
+}
+
+int main(int argc, char **argv)
+{
+    double secs, arena_secs, allocs;
+    size_t sum = 0, arena_sum = 0;
+    double peak;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:k:b:h")) != EOF) {
+	switch (c) {
+	case 'n':
+	    num_requests = atoi(optarg);
+	    break;
+	case 'k':
+	    num_objects = atoi(optarg);
+	    break;
+	case 'b':
+	    block_size = strtoul(optarg, NULL, 0);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    mem_init();
+    allocs = (double)num_requests * num_objects;
+
+    printf("%7s%10s%12s%10s\n", "mode", "secs", "Kallocs/s", "peak KB");
+    secs = run_malloc(&sum);
+    peak = mem_peak_footprint() / 1024.0;
+    printf("%7s%10.4f%12.0f%10.1f\n", "malloc", secs, allocs / 1e3 / secs,
+	   peak);
+    arena_secs = run_arena(&arena_sum);
+    peak = mem_peak_footprint() / 1024.0;
+    printf("%7s%10.4f%12.0f%10.1f\n", "arena", arena_secs,
+	   allocs / 1e3 / arena_secs, peak);
+    printf("speedup %.2fx\n", secs / arena_secs);
+
+    if (sum != arena_sum) {
+	fprintf(stderr, "the runs saw different objects\n");
+	exit(1);
+    }
+
+    mem_deinit();
+    exit(0);
+}
@@ -30,7 +30,9 @@
   "random-bal.rep",\
   "random2-bal.rep",\
   "binary-bal.rep",\
-  "binary2-bal.rep"
+  "binary2-bal.rep",\
+  "realloc-bal.rep",\
+  "realloc2-bal.rep"
 
 /*
  * This constant gives the estimated performance of the libc malloc
@@ -51,15 +53,24 @@
 #define UTIL_WEIGHT .60
 
 /*
- * Alignment requirement in bytes (either 4 or 8)
+ * Alignment requirement in bytes (8 or 16, -DALIGNMENT=<bytes>), 16 keeps
+ * payloads aligned for SSE/NEON loads and long double like glibc on 64 bit
  */
-#define ALIGNMENT 8
+#ifndef ALIGNMENT
+#define ALIGNMENT 16
+#endif
 
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes, unless another size is chosen at run time
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Largest maximum heap size in bytes that can be chosen at run time
+ * (mdriver -M or the environment variable MM_MAX_HEAP)
+ */
+#define MAX_HEAP_LIMIT ((size_t)1 << (sizeof(void *) == 8 ? 32 : 28))
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -12,9 +12,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -30,8 +36,13 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Handles with compaction (-C) */
+#define COMPACT_SAMPLES 10          /* utilization samples per trace */
+#define COMPACT_EVERY   64          /* requests between mm_compact calls */
+#define COMPACT_BUDGET  (16 * 1024) /* bytes one mm_compact call moves */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -46,9 +57,13 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, MEMALIGN,
+	  BATCH_ALLOC, BATCH_FREE, FREE_SIZED} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
+    int size;                         /* byte size of alloc/realloc request,
+					 block size of a sized free */
+    int align;                        /* alignment of a memalign request */
+    int count;                        /* blocks index.. of a batch request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -56,6 +71,7 @@ typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
+    int num_requests;    /* number of requests, a batch counts per block */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
@@ -81,6 +97,20 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double lat_p50;  /* mm_malloc latency percentiles in nsecs (set by -L) */
+    double lat_p99;
+    double lat_p999;
+    double lat_max;
+    double heap_final; /* heap plus mapped bytes after the trace */
+    double heap_peak;  /* largest heap plus mapped bytes during the trace */
+    double dtlb_misses; /* dTLB load misses of one run (set by -T), -1 if
+			   the machine has no counter for them */
+    int counted;       /* mm_stats worked, mm.c was built with -DSTATS */
+    double payload_peak; /* most payload bytes in use at once (set by -S) */
+    mm_stats_t at_peak; /* mm_stats when the payload peaked */
+    mm_stats_t at_end;  /* mm_stats after the trace */
+    double compact_util[2][COMPACT_SAMPLES]; /* utilization over time with
+			   handles, without and with mm_compact (set by -C) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -90,6 +120,7 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int sized_frees = 0; /* read every free as mm_free_sized (set by -s) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -100,6 +131,11 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The names of the mm placement policies for -P, indexed by policy */
+static char *policy_names[MM_POLICIES] = {
+    "first", "next", "good", "best", "address"
+};
+
 
 /********************* 
  * Function prototypes 
@@ -112,6 +148,8 @@ static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
+static int trace_size(trace_t *trace, unsigned index, unsigned count,
+		      int size);
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
 
@@ -121,12 +159,28 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void eval_mm(char **tracefiles, int num_tracefiles, stats_t *stats,
+		    int latency, int dtlb, int counters, int compacting);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static double eval_mm_dtlb(speed_t *params);
+static void eval_mm_stats(trace_t *trace, stats_t *stats);
+static void eval_mm_compact(trace_t *trace, int tracenum, int compact,
+			    double *util);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printheap(int n, stats_t *stats);
+static void printdtlb(int n, stats_t *stats);
+static void printpolicies(int n, stats_t **policy_stats);
+static void printsized(int n, stats_t *stats, stats_t *sized_stats);
+static void printmmstats(int n, stats_t *stats);
+static void printcompact(int n, stats_t *stats);
+static void perf_parts(double util, double throughput, double *p1, double *p2);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -142,14 +196,24 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *policy_stats[MM_POLICIES] = {NULL}; /* mm stats per policy (-P all) */
+    stats_t *sized_stats = NULL; /* mm stats with sized frees (-s) */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int latency = 0;     /* If set, measure mm_malloc latency (set by -L) */
+    int dtlb = 0;        /* If set, count dTLB misses (set by -T) */
+    int sweep = 0;       /* If set, run every placement policy (-P all) */
+    int sized = 0;       /* If set, run again with sized frees (set by -s) */
+    int counters = 0;    /* If set, report mm_stats of every trace (-S) */
+    int compacting = 0;  /* If set, run with handles and mm_compact (-C) */
+    int policy;
+    int check_level;
+    unsigned check_every;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +222,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:M:P:c:hvVgalLHTsSC")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +242,60 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'M': /* Maximum heap size in MB, overrides MM_MAX_HEAP */
+	    if (mem_set_max_heap((size_t)atoi(optarg) << 20) < 0) {
+		fprintf(stderr, "mdriver: -M %s is not between 1 and %lu MB\n",
+			optarg, (unsigned long)(MAX_HEAP_LIMIT >> 20));
+		exit(1);
+	    }
+	    break;
+        case 'P': /* Placement policy of mm.c, or all of them */
+	    if (!strcmp(optarg, "all")) {
+		sweep = 1;
+		break;
+	    }
+	    for (policy = 0; policy < MM_POLICIES; policy++)
+		if (!strcmp(optarg, policy_names[policy]))
+		    break;
+	    if (policy == MM_POLICIES || mm_set_policy(policy) < 0) {
+		fprintf(stderr, "mdriver: -P %s is not a policy of this mm.c\n",
+			optarg);
+		exit(1);
+	    }
+	    break;
+        case 'c': /* Heap check level of mm.c, and the full scan period */
+	    check_every = 0;
+	    if (sscanf(optarg, "%d:%u", &check_level, &check_every) < 1 ||
+		mm_set_check(check_level, check_every) < 0) {
+		fprintf(stderr, "mdriver: -c %s is not a check level of this "
+			"mm.c (0-3, 1-3 need -DCHECKHEAP)\n", optarg);
+		exit(1);
+	    }
+	    break;
+        case 'H': /* Back the heap with huge pages */
+	    mem_set_huge_pages(1);
+	    break;
+        case 'T': /* Count dTLB misses */
+	    dtlb = 1;
+	    break;
+        case 's': /* Compare mm_free_sized with mm_free */
+	    sized = 1;
+	    break;
+        case 'S': /* Report the statistics of mm.c */
+	    counters = 1;
+	    break;
+        case 'C': /* Run with handles, without and with compaction */
+	    compacting = 1;
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Measure mm_malloc latency percentiles */
+            latency = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -253,7 +365,7 @@ int main(int argc, char **argv)
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
+	    libc_stats[i].ops = trace->num_requests;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
@@ -279,32 +391,48 @@ int main(int argc, char **argv)
     if (verbose > 1)
 	printf("\nTesting mm malloc\n");
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
+    if (sweep) {
+	/* Evaluate every placement policy the build supports, the rest of
+	   the results are the ones of the policy mm.c was built with */
+	int built = mm_set_policy(MM_FIRST_FIT);
+
+	for (policy = 0; policy < MM_POLICIES; policy++) {
+	    if (mm_set_policy(policy) < 0)
+		continue;
 	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		printf("\nPlacement policy %s\n", policy_names[policy]);
+	    policy_stats[policy] = (stats_t *)calloc(num_tracefiles,
+						     sizeof(stats_t));
+	    if (policy_stats[policy] == NULL)
+		unix_error("policy_stats calloc in main failed");
+	    eval_mm(tracefiles, num_tracefiles, policy_stats[policy],
+		    latency, dtlb, counters, compacting);
 	}
-	free_trace(trace);
+	mm_set_policy(built);
+	mm_stats = policy_stats[built];
+    }
+    else {
+	/* Allocate the mm stats array, with one stats_t struct per tracefile */
+	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mm_stats == NULL)
+	    unix_error("mm_stats calloc in main failed");
+	eval_mm(tracefiles, num_tracefiles, mm_stats, latency, dtlb,
+		counters, compacting);
+    }
+
+    if (sized) {
+	/* Evaluate the traces again with every free as mm_free_sized */
+	sized_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (sized_stats == NULL)
+	    unix_error("sized_stats calloc in main failed");
+	if (verbose > 1)
+	    printf("\nSized frees\n");
+	sized_frees = 1;
+	eval_mm(tracefiles, num_tracefiles, sized_stats, 0, 0, 0, 0);
+	sized_frees = 0;
     }
 
     /* Display the mm results in a compact table */
@@ -312,6 +440,53 @@ int main(int argc, char **argv)
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printf("mm heap plus mapped size (KB):\n");
+	printheap(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the mm_malloc latency percentiles */
+    if (latency) {
+	printf("mm_malloc latency (nsecs):\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the dTLB misses */
+    if (dtlb) {
+	printf("mm dTLB load misses (%s pages):\n",
+	       mem_huge_pages() ? "huge" : "normal");
+	printdtlb(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the placement policies side by side */
+    if (sweep) {
+	printf("mm placement policies (util per trace):\n");
+	printpolicies(num_tracefiles, policy_stats);
+	printf("\n");
+    }
+
+    /* Display mm_free and mm_free_sized side by side */
+    if (sized) {
+	printf("mm_free vs mm_free_sized (Kops):\n");
+	printsized(num_tracefiles, mm_stats, sized_stats);
+	printf("\n");
+    }
+
+    /* Display the statistics of mm.c */
+    if (counters) {
+	printf("mm statistics:\n");
+	printmmstats(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the utilization over time with and without compaction */
+    if (compacting) {
+	printf("mm utilization over time with handles, without (-) and "
+	       "with (C) mm_compact:\n");
+	printcompact(num_tracefiles, mm_stats);
+	printf("\n");
     }
 
     /* 
@@ -336,14 +511,7 @@ int main(int argc, char **argv)
     if (errors == 0) {
 	avg_mm_throughput = ops/secs;
 
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
-	}
+	perf_parts(avg_mm_util, avg_mm_throughput, &p1, &p2);
 	
 	perfindex = (p1 + p2)*100.0;
 	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
@@ -395,9 +563,11 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or entirely
+       outside of the heap regions (a mapping of mem_map) */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	((mem_region_of(lo) >= 0) || (mem_region_of(hi) >= 0))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -468,6 +638,27 @@ static void clear_ranges(range_t **ranges)
  * The following routines manipulate tracefiles
  *********************************************/
 
+/*
+ * trace_size - While a trace is read, block_sizes holds the size of the
+ *     last request of every id, a sized free needs it. Sets the size of
+ *     the ids index..index+count-1 and returns the size of index, or
+ *     just returns it if size is negative.
+ */
+static int trace_size(trace_t *trace, unsigned index, unsigned count,
+		      int size)
+{
+    unsigned i;
+
+    if (index + count > (unsigned)trace->num_ids) {
+	printf("Id %u out of range in tracefile\n", index + count - 1);
+	exit(1);
+    }
+    if (size >= 0)
+	for (i = 0; i < count; i++)
+	    trace->block_sizes[index + i] = size;
+    return trace->block_sizes[index];
+}
+
 /*
  * read_trace - read a trace file and store it in memory
  */
@@ -477,7 +668,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align, count;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -518,6 +709,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_requests = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
 	switch(type[0]) {
 	case 'a':
@@ -526,6 +718,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
+	    trace_size(trace, index, 1, size);
 	    break;
 	case 'r':
 	    fscanf(tracefile, "%u %u", &index, &size);
@@ -533,11 +726,44 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
+	    trace_size(trace, index, 1, size);
 	    break;
 	case 'f':
+	case 's':
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    if (type[0] == 's' || sized_frees) {
+		trace->ops[op_index].type = FREE_SIZED;
+		trace->ops[op_index].size = trace_size(trace, index, 1, -1);
+	    }
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &size, &align);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = align;
+	    max_index = (index > max_index) ? index : max_index;
+	    trace_size(trace, index, 1, size);
+	    break;
+	case 'b':
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    trace->ops[op_index].type = BATCH_ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    trace->ops[op_index].size = size;
+	    trace_size(trace, index, count, size);
+	    index += count - 1;
+	    max_index = (index > max_index) ? index : max_index;
+	    trace->num_requests += count - 1;
+	    break;
+	case 'B':
+	    fscanf(tracefile, "%u %u", &index, &count);
+	    trace->ops[op_index].type = BATCH_FREE;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    trace->num_requests += count - 1;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -545,7 +771,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    exit(1);
 	}
 	op_index++;
-	
+	trace->num_requests++;
     }
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
@@ -571,6 +797,48 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * eval_mm - Evaluate the mm malloc package on every trace file, using
+ *     the K-best scheme for the speed, stats has one entry per file
+ */
+static void eval_mm(char **tracefiles, int num_tracefiles, stats_t *stats,
+		    int latency, int dtlb, int counters, int compacting)
+{
+    int i;
+    trace_t *trace;         /* stores a single trace file in memory */
+    range_t *ranges = NULL; /* keeps track of block extents for one trace */
+    speed_t speed_params;   /* input parameters to eval_mm_speed */
+
+    for (i=0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_requests;
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness, ");
+	stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (stats[i].valid) {
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    stats[i].util = eval_mm_util(trace, i, &ranges, &stats[i]);
+	    speed_params.trace = trace;
+	    speed_params.ranges = ranges;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (latency)
+		eval_mm_latency(trace, &stats[i]);
+	    if (dtlb)
+		stats[i].dtlb_misses = eval_mm_dtlb(&speed_params);
+	    if (counters)
+		eval_mm_stats(trace, &stats[i]);
+	    if (compacting) {
+		eval_mm_compact(trace, i, 0, stats[i].compact_util[0]);
+		eval_mm_compact(trace, i, 1, stats[i].compact_util[1]);
+	    }
+	}
+	free_trace(trace);
+    }
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -579,6 +847,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     int i, j;
     int index;
     int size;
+    int count;
     int oldsize;
     char *newp;
     char *oldp;
@@ -629,6 +898,52 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
+        case MEMALIGN: /* mm_memalign */
+
+	    /* Call the student's memalign */
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+
+	    /* The payload must have the requested alignment */
+	    if (((uintptr_t)p % trace->ops[i].align) != 0) {
+		sprintf(msg, "Payload address (%p) not aligned to %d bytes",
+			p, trace->ops[i].align);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+
+	    /* Check the range and fill it like a block of mm_malloc */
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+
+	    /* Remember region */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case BATCH_ALLOC: /* mm_malloc_batch */
+
+	    /* Call the student's batch malloc, blocks index.. get the blocks */
+	    count = trace->ops[i].count;
+	    if (mm_malloc_batch(size, count, (void **)&trace->blocks[index])
+		!= (size_t)count) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+
+	    /* Check and fill every block like a block of mm_malloc */
+	    for (j = 0; j < count; j++) {
+		p = trace->blocks[index + j];
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    return 0;
+		memset(p, (index + j) & 0xFF, size);
+		trace->block_sizes[index + j] = size;
+	    }
+	    break;
+
         case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
@@ -653,7 +968,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -674,6 +989,23 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+        case FREE_SIZED: /* mm_free_sized */
+
+	    /* Like mm_free, size is the size of the last request */
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    mm_free_sized(p, size);
+	    break;
+
+        case BATCH_FREE: /* mm_free_batch */
+
+	    /* Remove the regions, mm_free_batch reorders blocks index.. */
+	    count = trace->ops[i].count;
+	    for (j = 0; j < count; j++)
+		remove_range(ranges, trace->blocks[index + j]);
+	    mm_free_batch((void **)&trace->blocks[index], count);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -689,17 +1021,18 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak size of the heap plus all mem_map mappings in bytes while
+ *   running the student's malloc package on the trace. mem_sbrk() can
+ *   shrink the heap, so the final size is kept apart in stats and may
+ *   be smaller than the peak.
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats)
 {   
-    int i;
+    int i, j;
     int index;
-    int size, newsize, oldsize;
+    int size, newsize, oldsize, count;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
@@ -733,6 +1066,37 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		total_size : max_total_size;
 	    break;
 
+        case MEMALIGN: /* mm_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign failed in eval_mm_util");
+
+	    /* Only the payload counts, the alignment padding is overhead */
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case BATCH_ALLOC: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    count = trace->ops[i].count;
+
+	    if (mm_malloc_batch(size, count, (void **)&trace->blocks[index])
+		!= (size_t)count)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+
+	    for (j = 0; j < count; j++)
+		trace->block_sizes[index + j] = size;
+	    total_size += size * count;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -768,13 +1132,31 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case FREE_SIZED: /* mm_free_sized */
+	    index = trace->ops[i].index;
+	    size = trace->block_sizes[index];
+	    mm_free_sized(trace->blocks[index], trace->ops[i].size);
+	    total_size -= size;
+	    break;
+
+        case BATCH_FREE: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    count = trace->ops[i].count;
+
+	    for (j = 0; j < count; j++)
+		total_size -= trace->block_sizes[index + j];
+	    mm_free_batch((void **)&trace->blocks[index], count);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->heap_final = mem_footprint();
+    stats->heap_peak = mem_peak_footprint();
+    return ((double)max_total_size / (double)mem_peak_footprint());
 }
 
 
@@ -805,6 +1187,23 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if (mm_malloc_batch(size, trace->ops[i].count,
+				(void **)&trace->blocks[index])
+		!= (size_t)trace->ops[i].count)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+            break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -820,11 +1219,355 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+        case FREE_SIZED: /* mm_free_sized */
+            index = trace->ops[i].index;
+            block = trace->blocks[index];
+            mm_free_sized(block, trace->ops[i].size);
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            index = trace->ops[i].index;
+            mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+            break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
+/*
+ * cmp_double - qsort comparison function for eval_mm_latency
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_latency - Time every single mm_malloc call of the trace and
+ *    record the median, p99, p99.9 and max latency. The tail matters
+ *    more than the mean for allocators with unbounded searches.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    int i, n = 0;
+    double *lat;
+    char *p;
+    struct timespec t0, t1;
+
+    if ((lat = (double *)malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_latency");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    p = mm_malloc(trace->ops[i].size);
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    if (p == NULL)
+		app_error("mm_malloc failed in eval_mm_latency");
+	    lat[n++] = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+        case MEMALIGN: /* mm_memalign, not timed */
+	    if ((p = mm_memalign(trace->ops[i].align,
+				 trace->ops[i].size)) == NULL)
+		app_error("mm_memalign failed in eval_mm_latency");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+        case BATCH_ALLOC: /* mm_malloc_batch, not timed */
+	    if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+				(void **)&trace->blocks[trace->ops[i].index])
+		!= (size_t)trace->ops[i].count)
+		app_error("mm_malloc_batch failed in eval_mm_latency");
+	    break;
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[trace->ops[i].index],
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_latency");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+        case FREE: /* mm_free */
+	    mm_free(trace->blocks[trace->ops[i].index]);
+	    break;
+        case FREE_SIZED: /* mm_free_sized */
+	    mm_free_sized(trace->blocks[trace->ops[i].index],
+			  trace->ops[i].size);
+	    break;
+        case BATCH_FREE: /* mm_free_batch */
+	    mm_free_batch((void **)&trace->blocks[trace->ops[i].index],
+			  trace->ops[i].count);
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	}
+    }
+
+    if (n > 0) {
+	qsort(lat, n, sizeof(double), cmp_double);
+	stats->lat_p50 = lat[n / 2];
+	stats->lat_p99 = lat[(int)(n * 0.99)];
+	stats->lat_p999 = lat[(int)(n * 0.999)];
+	stats->lat_max = lat[n - 1];
+    }
+    free(lat);
+}
+
+/*
+ * eval_mm_stats - Run the trace once more and take mm_stats at the
+ *    request with the most payload in use, where fragmentation matters,
+ *    and after the last one for the counters of the whole trace
+ */
+static void eval_mm_stats(trace_t *trace, stats_t *stats)
+{
+    int i, j, index, count, peak = -1;
+    double total = 0;
+    char *p;
+
+    /* Find the request with the most payload in use */
+    stats->payload_peak = 0;
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	count = trace->ops[i].count;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+        case MEMALIGN:
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    total += trace->ops[i].size;
+	    break;
+        case BATCH_ALLOC:
+	    for (j = 0; j < count; j++)
+		trace->block_sizes[index + j] = trace->ops[i].size;
+	    total += (double)trace->ops[i].size * count;
+	    break;
+	case REALLOC:
+	    total += (double)trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+        case FREE:
+        case FREE_SIZED:
+	    total -= trace->block_sizes[index];
+	    break;
+        case BATCH_FREE:
+	    for (j = 0; j < count; j++)
+		total -= trace->block_sizes[index + j];
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_stats");
+	}
+	if (total > stats->payload_peak) {
+	    stats->payload_peak = total;
+	    peak = i;
+	}
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_stats");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_stats");
+	    trace->blocks[index] = p;
+	    break;
+        case MEMALIGN: /* mm_memalign */
+	    if ((p = mm_memalign(trace->ops[i].align,
+				 trace->ops[i].size)) == NULL)
+		app_error("mm_memalign failed in eval_mm_stats");
+	    trace->blocks[index] = p;
+	    break;
+        case BATCH_ALLOC: /* mm_malloc_batch */
+	    if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+				(void **)&trace->blocks[index])
+		!= (size_t)trace->ops[i].count)
+		app_error("mm_malloc_batch failed in eval_mm_stats");
+	    break;
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[index],
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_stats");
+	    trace->blocks[index] = p;
+	    break;
+        case FREE: /* mm_free */
+	    mm_free(trace->blocks[index]);
+	    break;
+        case FREE_SIZED: /* mm_free_sized */
+	    mm_free_sized(trace->blocks[index], trace->ops[i].size);
+	    break;
+        case BATCH_FREE: /* mm_free_batch */
+	    mm_free_batch((void **)&trace->blocks[index],
+			  trace->ops[i].count);
+	    break;
+	}
+	if (i == peak)
+	    mm_stats(&stats->at_peak);
+    }
+
+    stats->counted = mm_stats(&stats->at_end) == 0;
+}
+
+/*
+ * halloc_block - Allocate the block of a handle and mark its first and
+ *    last byte with the id of the block
+ */
+static mm_handle_t halloc_block(int index, int size)
+{
+    mm_handle_t handle;
+    char *p;
+
+    if ((handle = mm_halloc(size)) == NULL)
+	app_error("mm_halloc failed in eval_mm_compact");
+    p = mm_hlock(handle);
+    p[0] = p[size - 1] = (char)index;
+    mm_hunlock(handle);
+    return handle;
+}
+
+/*
+ * hfree_block - Check that the block of a handle kept its marks while
+ *    it moved and free it
+ */
+static void hfree_block(int tracenum, int opnum, mm_handle_t handle,
+			int index, int size)
+{
+    char *p = mm_hlock(handle);
+
+    if (p[0] != (char)index || p[size - 1] != (char)index)
+	malloc_error(tracenum, opnum,
+		     "mm_compact did not keep the bytes of a handle block");
+    mm_hunlock(handle);
+    mm_hfree(handle);
+}
+
+/*
+ * eval_mm_compact - Run the trace with one handle per block instead of
+ *    pointers, with compact set mm_compact moves COMPACT_BUDGET bytes
+ *    every COMPACT_EVERY requests. util gets the payload in use over
+ *    the current heap size in the middle of every tenth of the trace.
+ *    The blocks are only locked to mark and check them
+ */
+static void eval_mm_compact(trace_t *trace, int tracenum, int compact,
+			    double *util)
+{
+    int i, j, index, size, oldsize, count, sample = 0;
+    double total = 0;
+    mm_handle_t *handles, handle;
+    char *p, *newp;
+
+    if ((handles = calloc(trace->num_ids, sizeof(mm_handle_t))) == NULL)
+	unix_error("calloc failed in eval_mm_compact");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_compact");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	count = trace->ops[i].count;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_halloc */
+        case MEMALIGN: /* mm_halloc, handle blocks have no alignment */
+	    handles[index] = halloc_block(index, size);
+	    trace->block_sizes[index] = size;
+	    total += size;
+	    break;
+        case BATCH_ALLOC: /* one mm_halloc per block */
+	    for (j = 0; j < count; j++) {
+		handles[index + j] = halloc_block(index + j, size);
+		trace->block_sizes[index + j] = size;
+	    }
+	    total += (double)size * count;
+	    break;
+	case REALLOC: /* mm_halloc, copy, mm_hfree */
+	    oldsize = trace->block_sizes[index];
+	    handle = halloc_block(index, size);
+	    p = mm_hlock(handles[index]);
+	    newp = mm_hlock(handle);
+	    memcpy(newp, p, size < oldsize ? size : oldsize);
+	    newp[size - 1] = (char)index;
+	    mm_hunlock(handle);
+	    mm_hunlock(handles[index]);
+	    hfree_block(tracenum, i, handles[index], index, oldsize);
+	    handles[index] = handle;
+	    trace->block_sizes[index] = size;
+	    total += size - oldsize;
+	    break;
+        case FREE: /* mm_hfree */
+        case FREE_SIZED:
+	    hfree_block(tracenum, i, handles[index], index,
+			trace->block_sizes[index]);
+	    total -= trace->block_sizes[index];
+	    break;
+        case BATCH_FREE: /* one mm_hfree per block */
+	    for (j = 0; j < count; j++) {
+		hfree_block(tracenum, i, handles[index + j], index + j,
+			    trace->block_sizes[index + j]);
+		total -= trace->block_sizes[index + j];
+	    }
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_compact");
+	}
+
+	if (compact && i % COMPACT_EVERY == COMPACT_EVERY - 1)
+	    mm_compact(COMPACT_BUDGET);
+
+	/* Sample in the middle of every tenth of the trace */
+	while (sample < COMPACT_SAMPLES &&
+	       i >= (2L * sample + 1) * trace->num_ops / (2 * COMPACT_SAMPLES))
+	    util[sample++] = total / mem_footprint();
+    }
+
+    free(handles);
+}
+
+/*
+ * eval_mm_dtlb - Count the dTLB load misses of one run of the trace with
+ *    a hardware counter of the CPU. Returns -1 if the machine (or the
+ *    virtual machine) has no such counter.
+ */
+static double eval_mm_dtlb(speed_t *params)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    long long count;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+	(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if ((fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) < 0)
+	return -1;
+
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    eval_mm_speed(params);
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+	count = -1;
+    close(fd);
+    return (double)count;
+#else
+    return -1;
+#endif
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -833,7 +1576,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, j, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -847,6 +1590,25 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    trace->blocks[trace->ops[i].index] = p;
 	    break;
 
+        case MEMALIGN: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case BATCH_ALLOC: /* one malloc per block */
+	    for (j = 0; j < trace->ops[i].count; j++) {
+		if ((p = malloc(trace->ops[i].size)) == NULL) {
+		    malloc_error(tracenum, i, "libc malloc failed");
+		    unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index + j] = p;
+	    }
+	    break;
+
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
@@ -858,9 +1620,15 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    break;
 	    
         case FREE: /* free */
+        case FREE_SIZED:
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case BATCH_FREE: /* one free per block */
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[trace->ops[i].index + j]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -876,7 +1644,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -891,6 +1659,24 @@ static void eval_libc_speed(void *ptr)
 	    trace->blocks[index] = p;
 	    break;
 
+        case MEMALIGN: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (posix_memalign((void **)&p, trace->ops[i].align, size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case BATCH_ALLOC: /* one malloc per block */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    for (j = 0; j < trace->ops[i].count; j++) {
+		if ((p = malloc(size)) == NULL)
+		    unix_error("malloc failed in eval_libc_speed");
+		trace->blocks[index + j] = p;
+	    }
+	    break;
+
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -902,10 +1688,17 @@ static void eval_libc_speed(void *ptr)
 	    break;
 	    
         case FREE: /* free */
+        case FREE_SIZED:
 	    index = trace->ops[i].index;
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case BATCH_FREE: /* one free per block */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[index + j]);
+	    break;
 	}
     }
 }
@@ -972,6 +1765,266 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printlatency - prints the mm_malloc latency percentiles of every trace
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s%10s\n", "trace", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%13.0f%10.0f%10.0f%10.0f\n", i, stats[i].lat_p50,
+		   stats[i].lat_p99, stats[i].lat_p999, stats[i].lat_max);
+	else
+	    printf("%2d%13s%10s%10s%10s\n", i, "-", "-", "-", "-");
+    }
+}
+
+/*
+ * printdtlb - prints the dTLB load misses of every trace
+ */
+static void printdtlb(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s\n", "trace", "misses", "per op");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].dtlb_misses >= 0)
+	    printf("%2d%13.0f%10.3f\n", i, stats[i].dtlb_misses,
+		   stats[i].dtlb_misses / stats[i].ops);
+	else
+	    printf("%2d%13s%10s\n", i, "-", "-");
+    }
+}
+
+/*
+ * printpolicies - prints the utilization of every trace, the total
+ *     utilization, the throughput and the performance index of every
+ *     placement policy side by side ("-" if the build does not support it)
+ */
+static void printpolicies(int n, stats_t **policy_stats)
+{
+    int i, policy;
+    double util[MM_POLICIES] = {0};
+    double ops[MM_POLICIES] = {0};
+    double secs[MM_POLICIES] = {0};
+    int valid[MM_POLICIES];
+    double p1, p2;
+
+    printf("%5s", "trace");
+    for (policy = 0; policy < MM_POLICIES; policy++) {
+	printf("%9s", policy_names[policy]);
+	valid[policy] = policy_stats[policy] != NULL;
+    }
+    printf("\n");
+
+    for (i=0; i < n; i++) {
+	printf("%2d   ", i);
+	for (policy = 0; policy < MM_POLICIES; policy++) {
+	    stats_t *stats = policy_stats[policy];
+
+	    if (stats == NULL || !stats[i].valid) {
+		printf("%9s", "-");
+		valid[policy] = 0;
+		continue;
+	    }
+	    printf("%8.1f%%", stats[i].util*100.0);
+	    util[policy] += stats[i].util;
+	    ops[policy] += stats[i].ops;
+	    secs[policy] += stats[i].secs;
+	}
+	printf("\n");
+    }
+
+    printf("%-5s", "Total");
+    for (policy = 0; policy < MM_POLICIES; policy++) {
+	if (valid[policy])
+	    printf("%8.1f%%", util[policy]/n*100.0);
+	else
+	    printf("%9s", "-");
+    }
+    printf("\n%-5s", "Kops");
+    for (policy = 0; policy < MM_POLICIES; policy++) {
+	if (valid[policy])
+	    printf("%9.0f", ops[policy]/1e3/secs[policy]);
+	else
+	    printf("%9s", "-");
+    }
+    printf("\n%-5s", "Perf");
+    for (policy = 0; policy < MM_POLICIES; policy++) {
+	if (valid[policy]) {
+	    perf_parts(util[policy]/n, ops[policy]/secs[policy], &p1, &p2);
+	    printf("%9.0f", (p1 + p2)*100.0);
+	}
+	else
+	    printf("%9s", "-");
+    }
+    printf("\n");
+}
+
+/*
+ * perf_parts - splits the performance index of an average utilization
+ *     and throughput (ops per second) into its util and thru parts
+ */
+static void perf_parts(double util, double throughput, double *p1, double *p2)
+{
+    *p1 = UTIL_WEIGHT * util;
+    if (throughput > AVG_LIBC_THRUPUT)
+	*p2 = (double)(1.0 - UTIL_WEIGHT);
+    else
+	*p2 = ((double) (1.0 - UTIL_WEIGHT)) * (throughput/AVG_LIBC_THRUPUT);
+}
+
+/*
+ * printsized - prints the throughput of every trace with mm_free and
+ *     with mm_free_sized and the speedup of the sized frees
+ */
+static void printsized(int n, stats_t *stats, stats_t *sized_stats)
+{
+    int i;
+    double secs = 0, sized_secs = 0, ops = 0;
+
+    printf("%5s%10s%10s%10s\n", "trace", "free", "sized", "speedup");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && sized_stats[i].valid) {
+	    printf("%2d%13.0f%10.0f%9.2fx\n", i,
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   (sized_stats[i].ops/1e3)/sized_stats[i].secs,
+		   stats[i].secs/sized_stats[i].secs);
+	    secs += stats[i].secs;
+	    sized_secs += sized_stats[i].secs;
+	    ops += stats[i].ops;
+	}
+	else
+	    printf("%2d%13s%10s%10s\n", i, "-", "-", "-");
+    }
+    if (secs > 0 && sized_secs > 0)
+	printf("%-5s%10.0f%10.0f%9.2fx\n", "Total", (ops/1e3)/secs,
+	       (ops/1e3)/sized_secs, secs/sized_secs);
+}
+
+/*
+ * printmmstats - prints the counters of mm_stats for every trace and the
+ *     fragmentation when its payload peaked: internal is the part of the
+ *     used bytes that is not payload, external the part of the free bytes
+ *     that is not in the largest free chunk. the requests per size class
+ *     are summed up over all traces
+ */
+static void printmmstats(int n, stats_t *stats)
+{
+    int i, cls;
+    unsigned long mallocs[MM_STAT_CLASSES] = {0};
+    unsigned long reallocs[MM_STAT_CLASSES] = {0};
+    unsigned long frees[MM_STAT_CLASSES] = {0};
+    unsigned long free_chunks[MM_STAT_CLASSES] = {0};
+
+    for (i=0; i < n && !stats[i].counted; i++)
+	;
+    if (i == n) {
+	printf("no statistics, build mm.c with -DSTATS\n");
+	return;
+    }
+
+    printf("%5s%9s%9s%8s%8s%9s%6s%9s%7s%7s%7s\n", "trace", "mallocs",
+	   "frees", "search", "splits", "coalesce", "sbrks", "sbrk KB",
+	   "int", "ext", "free");
+    for (i=0; i < n; i++) {
+	mm_counters_t *c = &stats[i].at_end.count;
+	mm_stats_t *peak = &stats[i].at_peak;
+	unsigned long m = 0, f = 0;
+
+	if (!stats[i].valid || !stats[i].counted) {
+	    printf("%2d%12s\n", i, "-");
+	    continue;
+	}
+	for (cls = 0; cls < MM_STAT_CLASSES; cls++) {
+	    m += c->mallocs[cls];
+	    f += c->frees[cls];
+	    mallocs[cls] += c->mallocs[cls];
+	    reallocs[cls] += c->reallocs[cls];
+	    frees[cls] += c->frees[cls];
+	    free_chunks[cls] += peak->free_chunks[cls];
+	}
+	printf("%2d%12lu%9lu%8.1f%8lu%9lu%6lu%9.1f", i, m, f,
+	       c->searches ? (double)c->visited / c->searches : 0.0,
+	       c->splits, c->coalesces, c->sbrks, c->sbrk_bytes / 1024.0);
+	printf("%6.1f%%%6.1f%%%6.1f%%\n",
+	       peak->used_bytes ?
+	       (1 - stats[i].payload_peak / peak->used_bytes) * 100.0 : 0.0,
+	       peak->free_bytes ?
+	       (1 - (double)peak->largest_free / peak->free_bytes) * 100.0 : 0.0,
+	       peak->heap_bytes ?
+	       (double)peak->free_bytes / peak->heap_bytes * 100.0 : 0.0);
+    }
+
+    printf("\n%5s%9s%9s%9s%9s%12s\n", "class", "size <=", "mallocs",
+	   "reallocs", "frees", "free chunks");
+    for (cls = 0; cls < MM_STAT_CLASSES; cls++) {
+	if (mallocs[cls] == 0 && reallocs[cls] == 0 && frees[cls] == 0 &&
+	    free_chunks[cls] == 0)
+	    continue;
+	if (cls == MM_STAT_CLASSES - 1)
+	    printf("%5d%9s", cls, "-");
+	else
+	    printf("%5d%9lu", cls, 16ul << cls);
+	printf("%9lu%9lu%9lu%12lu\n", mallocs[cls], reallocs[cls], frees[cls],
+	       free_chunks[cls]);
+    }
+}
+
+/*
+ * printcompact - prints the utilization samples of every trace without
+ *     and with compaction and their average
+ */
+static void printcompact(int n, stats_t *stats)
+{
+    int i, k, compact;
+    double sum;
+
+    printf("%5s  ", "trace");
+    for (k = 0; k < COMPACT_SAMPLES; k++)
+	printf("%5d%%", (2 * k + 1) * 50 / COMPACT_SAMPLES);
+    printf("%7s\n", "avg");
+    for (i=0; i < n; i++) {
+	for (compact = 0; compact < 2; compact++) {
+	    if (compact == 0)
+		printf("%2d%5s", i, "-");
+	    else
+		printf("%7s", "C");
+	    if (!stats[i].valid) {
+		printf("%6s\n", "-");
+		continue;
+	    }
+	    sum = 0;
+	    for (k = 0; k < COMPACT_SAMPLES; k++) {
+		printf("%5.0f%%", stats[i].compact_util[compact][k] * 100.0);
+		sum += stats[i].compact_util[compact][k];
+	    }
+	    printf("%6.1f%%\n", sum / COMPACT_SAMPLES * 100.0);
+	}
+    }
+}
+
+/*
+ * printheap - prints the final and peak heap plus mapped size of every
+ *     trace
+ */
+static void printheap(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s\n", "trace", "final", "peak");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%13.1f%10.1f\n", i, stats[i].heap_final / 1024,
+		   stats[i].heap_peak / 1024);
+	else
+	    printf("%2d%13s%10s\n", i, "-", "-");
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +2057,26 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValLHTsSC] [-f <file>] [-t <dir>] "
+	    "[-M <MB>] [-P <policy>] [-c <level>[:<n>]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-C         Run with handles, without and with mm_compact.\n");
+    fprintf(stderr, "\t-c <l>[:n] Heap check level: 0 off, 1 touched chunks,\n"
+	    "\t           2 full scan every n ops, 3 full scan every op.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Back the heap with huge pages.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print mm_malloc latency percentiles.\n");
+    fprintf(stderr, "\t-M <MB>    Maximum heap size (default MM_MAX_HEAP).\n");
+    fprintf(stderr, "\t-P <name>  Placement policy: first, next, good, best,\n"
+	    "\t           address, or all to compare them.\n");
+    fprintf(stderr, "\t-s         Compare mm_free_sized with mm_free.\n");
+    fprintf(stderr, "\t-S         Print mm_stats (mm.c built with -DSTATS).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T         Print dTLB load misses.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +11,172 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * The model holds MEM_REGIONS independent heaps of mem_max_heap bytes
+ * each. Region 0 is the classic heap behind mem_sbrk, mem_heap_lo,
+ * mem_heap_hi and mem_heapsize.
+ *
+ * mem_init only reserves address space for the regions (PROT_NONE), one
+ * region every 1 << mem_stride_log2 bytes. The pages of a region are
+ * committed in steps of MEM_COMMIT bytes when its brk passes the
+ * committed end. They stay committed when the heap shrinks, so a heap
+ * that is trimmed and grows again (or a reset heap) does not fault in
+ * its pages every time.
+ *
+ * mem_max_heap is MAX_HEAP unless mem_set_max_heap or the environment
+ * variable MM_MAX_HEAP (bytes with an optional K, M or G suffix) chose
+ * another size, up to MAX_HEAP_LIMIT.
+ *
+ * With huge pages (mem_set_huge_pages or MM_HUGE_PAGES=1) the regions
+ * start on HUGE_PAGE boundaries, are advised as MADV_HUGEPAGE and are
+ * committed in steps of HUGE_PAGE bytes, so every committed step can be
+ * one transparent huge page. Mappings of at least HUGE_PAGE bytes are
+ * advised the same way. Without transparent huge pages mem_init falls
+ * back to normal pages.
+ */
+#define MEM_COMMIT (64 * 1024)
+#define HUGE_PAGE (2 * 1024 * 1024)
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
+static char *mem_start_brk;  /* points to first byte of region 0 */
+static char *mem_brk;        /* points to last byte of heap (region 0) */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *region_brk[MEM_REGIONS]; /* brk of every other region */
+static char *region_commit[MEM_REGIONS]; /* end of the committed pages */
+static size_t mem_max_heap;  /* maximum heap size of a region in bytes */
+static int mem_stride_log2;  /* log2 of the distance between regions */
+static size_t mem_commit;    /* bytes committed at once */
+static int mem_huge;         /* back the heap with huge pages */
+static size_t mem_mapped;    /* bytes of all live mem_map mappings */
+static size_t mem_peak;      /* largest heap (region 0) plus mapped bytes */
+
+/*
+ * parse_size - bytes of a size like 512M, 0 if it is no valid size
+ */
+static size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long size = strtoull(str, &end, 10);
+    int shift = 0;
+
+    switch (*end) {
+    case 'G': case 'g': shift += 10; /* fall through */
+    case 'M': case 'm': shift += 10; /* fall through */
+    case 'K': case 'k': shift += 10; end++;
+    }
+    if (end == str || *end != '\0' || size > (SIZE_MAX >> shift))
+	return 0;
+    return (size_t)size << shift;
+}
+
+/*
+ * mem_set_max_heap - sets the maximum heap size of every region for the
+ *    next mem_init. Returns -1 if bytes is 0 or above MAX_HEAP_LIMIT.
+ */
+int mem_set_max_heap(size_t bytes)
+{
+    if ((bytes == 0) || (bytes > MAX_HEAP_LIMIT))
+	return -1;
+    mem_max_heap = (bytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    return 0;
+}
+
+/*
+ * mem_set_huge_pages - asks for huge pages (on != 0) from the next
+ *    mem_init on
+ */
+void mem_set_huge_pages(int on)
+{
+    mem_huge = on ? 1 : -1;
+}
+
+/*
+ * mem_huge_pages - returns 1 if the heap is advised to use huge pages
+ */
+int mem_huge_pages(void)
+{
+    return mem_huge > 0;
+}
+
+/*
+ * reserve - reserves len bytes of address space without access, aligned
+ *    to align bytes (a power of two). Returns NULL on failure.
+ */
+static char *reserve(size_t len, size_t align)
+{
+    char *addr = mmap(NULL, len + align - mem_pagesize(), PROT_NONE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    char *aligned;
+
+    if (addr == MAP_FAILED)
+	return NULL;
+    aligned = (char *)(((uintptr_t)addr + align - 1) & ~(uintptr_t)(align - 1));
+    if (aligned != addr)
+	munmap(addr, (size_t)(aligned - addr));
+    if (align > mem_pagesize() + (size_t)(aligned - addr))
+	munmap(aligned + len, align - mem_pagesize() - (size_t)(aligned - addr));
+    return aligned;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    char *env = getenv("MM_MAX_HEAP");
+    int i;
+
+    if ((mem_max_heap == 0) && (env != NULL) &&
+	(mem_set_max_heap(parse_size(env)) < 0))
+	fprintf(stderr, "mem_init: ignoring MM_MAX_HEAP=%s\n", env);
+    if (mem_max_heap == 0)
+	mem_max_heap = MAX_HEAP;
+    if ((mem_huge == 0) && ((env = getenv("MM_HUGE_PAGES")) != NULL))
+	mem_huge = strcmp(env, "0") ? 1 : -1;
+
+    /* reserve the address space we will use to model the available VM */
+    for (mem_stride_log2 = 0; ((size_t)1 << mem_stride_log2) < mem_max_heap;
+	 mem_stride_log2++)
+	;
+    if ((mem_huge > 0) && (((size_t)1 << mem_stride_log2) < HUGE_PAGE))
+	mem_stride_log2 = __builtin_ctz(HUGE_PAGE);
+    mem_start_brk = reserve((size_t)MEM_REGIONS << mem_stride_log2,
+			    mem_huge > 0 ? HUGE_PAGE : mem_pagesize());
+    if (mem_start_brk == NULL) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_commit = MEM_COMMIT;
+    if (mem_huge > 0) {
+#ifdef MADV_HUGEPAGE
+	if (madvise(mem_start_brk, (size_t)MEM_REGIONS << mem_stride_log2,
+		    MADV_HUGEPAGE) == 0)
+	    mem_commit = HUGE_PAGE;
+	else
+	    fprintf(stderr, "mem_init: no transparent huge pages (%s), "
+		    "using normal pages\n", strerror(errno));
+#else
+	fprintf(stderr, "mem_init: no transparent huge pages on this system, "
+		"using normal pages\n");
+#endif
+	if (mem_commit != HUGE_PAGE)
+	    mem_huge = -1;
+    }
+
+    mem_max_addr = mem_start_brk + mem_max_heap;  /* max legal heap address */
+    mem_brk = mem_start_brk;                      /* heap is empty initially */
+    mem_mapped = 0;
+    mem_peak = 0;
+    for (i = 0; i < MEM_REGIONS; i++) {
+	region_brk[i] = mem_region_lo(i);
+	region_commit[i] = mem_region_lo(i);
+    }
 }
 
 /* 
@@ -39,7 +184,36 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, (size_t)MEM_REGIONS << mem_stride_log2);
+}
+
+/*
+ * mem_max_heapsize - returns the maximum heap size of a region in bytes
+ */
+size_t mem_max_heapsize(void)
+{
+    return mem_max_heap;
+}
+
+/*
+ * commit - makes the pages of a region up to brk accessible, in steps of
+ *    mem_commit bytes. Returns -1 if the system has no memory left.
+ */
+static int commit(int region, char *brk)
+{
+    char *end = region_commit[region];
+    char *limit = (char *)mem_region_lo(region) + mem_max_heap;
+    size_t len;
+
+    if (brk <= end)
+	return 0;
+    len = ((size_t)(brk - end) + mem_commit - 1) & ~(mem_commit - 1);
+    if (end + len > limit)
+	len = (size_t)(limit - end);
+    if (mprotect(end, len, PROT_READ | PROT_WRITE) != 0)
+	return -1;
+    region_commit[region] = end + len;
+    return 0;
 }
 
 /*
@@ -47,27 +221,124 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
+    int i;
+
     mem_brk = mem_start_brk;
+    mem_peak = __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+    for (i = 1; i < MEM_REGIONS; i++)
+	region_brk[i] = mem_region_lo(i);
+}
+
+/*
+ * update_peak - remember the largest heap plus mapped size, mappings are
+ *    made without a lock, so the maximum is kept with compare and swap
+ */
+static void update_peak(void)
+{
+    size_t now = mem_heapsize() + __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+
+    while (now > peak &&
+	   !__atomic_compare_exchange_n(&mem_peak, &peak, now, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap by -incr bytes and returns the
+ *    old brk, the heap cannot shrink below its start.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((incr < 0) && (mem_brk + incr < mem_start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr,
+		"ERROR: mem_sbrk failed. Shrinking below heap start...\n");
+	return (void *)-1;
+    }
+    if (((mem_brk + incr) > mem_max_addr) ||
+	((mem_brk + incr) > region_commit[0] && commit(0, mem_brk + incr) < 0)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    update_peak();
     return (void *)old_brk;
 }
 
+/*
+ * mem_region_sbrk - mem_sbrk for one of the regions
+ */
+void *mem_region_sbrk(int region, int incr)
+{
+    char *old_brk;
+
+    if (region == 0)
+	return mem_sbrk(incr);
+
+    old_brk = region_brk[region];
+    if ((incr < 0) && (old_brk + incr < (char *)mem_region_lo(region))) {
+	errno = EINVAL;
+	fprintf(stderr,
+		"ERROR: mem_region_sbrk failed. Shrinking below heap start...\n");
+	return (void *)-1;
+    }
+    if (((old_brk + incr) > (char *)mem_region_lo(region) + mem_max_heap) ||
+	((old_brk + incr) > region_commit[region] &&
+	 commit(region, old_brk + incr) < 0)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_region_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    region_brk[region] += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region
+ */
+void *mem_region_lo(int region)
+{
+    return (void *)(mem_start_brk + ((size_t)region << mem_stride_log2));
+}
+
+/*
+ * mem_region_hi - return address of the last heap byte of a region
+ */
+void *mem_region_hi(int region)
+{
+    if (region == 0)
+	return mem_heap_hi();
+    return (void *)(region_brk[region] - 1);
+}
+
+/*
+ * mem_region_size - returns the heap size of a region in bytes
+ */
+size_t mem_region_size(int region)
+{
+    return (size_t)((char *)mem_region_hi(region) + 1 -
+		    (char *)mem_region_lo(region));
+}
+
+/*
+ * mem_region_of - returns the region an address belongs to, -1 if none
+ */
+int mem_region_of(void *addr)
+{
+    char *p = (char *)addr;
+
+    if ((p < mem_start_brk) ||
+	(p >= mem_start_brk + ((size_t)MEM_REGIONS << mem_stride_log2)))
+	return -1;
+    return (int)((size_t)(p - mem_start_brk) >> mem_stride_log2);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -92,6 +363,87 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_footprint() - returns the heap size plus the bytes of all mappings
+ */
+size_t mem_footprint()
+{
+    return mem_heapsize() + __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_peak_footprint() - returns the largest footprint since the last
+ *    mem_reset_brk
+ */
+size_t mem_peak_footprint()
+{
+    return __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_map - maps bytes (rounded up to whole pages) of fresh memory outside
+ *    of the heap regions, so the mapping is not limited by MAX_HEAP.
+ *    Returns NULL if the system has no memory left.
+ */
+void *mem_map(size_t bytes)
+{
+    size_t len = (bytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    void *addr;
+
+    if (len < bytes)
+	return NULL;
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+	return NULL;
+#ifdef MADV_HUGEPAGE
+    if ((mem_huge > 0) && (len >= HUGE_PAGE))
+	madvise(addr, len, MADV_HUGEPAGE);
+#endif
+    __atomic_add_fetch(&mem_mapped, len, __ATOMIC_RELAXED);
+    update_peak();
+    return addr;
+}
+
+/*
+ * mem_remap - resizes a mapping of mem_map to bytes (rounded up to whole
+ *    pages), it may move. Returns the new address or NULL, the old
+ *    mapping stays valid on failure.
+ */
+void *mem_remap(void *addr, size_t old_bytes, size_t bytes)
+{
+    size_t old_len = (old_bytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    size_t len = (bytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    void *new_addr;
+
+    if (len < bytes)
+	return NULL;
+    new_addr = mremap(addr, old_len, len, MREMAP_MAYMOVE);
+    if (new_addr == MAP_FAILED)
+	return NULL;
+#ifdef MADV_HUGEPAGE
+    if ((mem_huge > 0) && (len >= HUGE_PAGE))
+	madvise(new_addr, len, MADV_HUGEPAGE);
+#endif
+    __atomic_add_fetch(&mem_mapped, len - old_len, __ATOMIC_RELAXED);
+    update_peak();
+    return new_addr;
+}
+
+/*
+ * mem_unmap - gives a mapping of mem_map back to the system
+ */
+void mem_unmap(void *addr, size_t bytes)
+{
+    size_t len = (bytes + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+
+    if (munmap(addr, len) != 0) {
+	fprintf(stderr, "ERROR: mem_unmap failed. %s\n", strerror(errno));
+	return;
+    }
+    __atomic_sub_fetch(&mem_mapped, len, __ATOMIC_RELAXED);
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
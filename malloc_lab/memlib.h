@@ -1,5 +1,11 @@
 #include <unistd.h>
 
+/* number of independent heaps (regions) the model provides */
+#define MEM_REGIONS 8
+
+int mem_set_max_heap(size_t bytes);
+void mem_set_huge_pages(int on);
+int mem_huge_pages(void);
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
@@ -7,5 +13,18 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_max_heapsize(void);
+size_t mem_footprint(void);
+size_t mem_peak_footprint(void);
 size_t mem_pagesize(void);
 
+void *mem_map(size_t bytes);
+void *mem_remap(void *addr, size_t old_bytes, size_t bytes);
+void mem_unmap(void *addr, size_t bytes);
+
+void *mem_region_sbrk(int region, int incr);
+void *mem_region_lo(int region);
+void *mem_region_hi(int region);
+size_t mem_region_size(int region);
+int mem_region_of(void *addr);
+
@@ -3,16 +3,14 @@
  *
  * Non free block:
  * ---------------
- *  - Size | free - Header
+ *  - Size | prev | free - Header
  *  ---------------
  *  -   Payload   -
  *  ---------------
- *  - Size | free - Footer
- *  ---------------
  *
  *  Free block:
  *  ---------------
- *  - Size | free - Header
+ *  - Size | prev | free - Header
  *  ---------------
  *  -  next_free  -
  *  ---------------
@@ -20,24 +18,77 @@
  *  ---------------
  *  -   ununsed   -
  *  ---------------
- *  - Size | free - Footer
+ *  - Size | prev | free - Footer
  *  ---------------
  *
- * Free blocks are a explicitly, doubly and circularly linked list
- * malloc uses first fit with splitting
- * free immediatly coalesces if possible
+ * Only free chunks have a footer (the prev_size of the next chunk), the
+ * payload of a not free chunk reaches into that word. The prev bit of the
+ * header tells if the chunk before is not free, only if it is free
+ * prev_size is valid.
+ *
+ * Free blocks are kept in segregated, doubly linked lists. Every list
+ * holds the chunks of one power of two size class.
+ * malloc uses first fit inside the size class of the request and takes
+ * the first chunk of the next non empty bigger class otherwise (with
+ * splitting). free immediatly coalesces if possible.
+ * Free chunks of at least TREE_MIN bytes are kept in a red black tree
+ * ordered by size instead and are found with best fit.
+ * mm_set_policy chooses another placement policy for the lists: next fit,
+ * good fit, best fit or first fit in address ordered lists (see PLACEMENT).
+ *
+ * With -DTLSF the lists are split in two levels with a bitmap per level
+ * and malloc finds a fitting list in constant time (see first_fit).
+ *
+ * With -DDEFER_COALESCE free puts small chunks into quick lists without
+ * coalescing, they are coalesced in one batch later (see consolidate).
+ *
+ * With -DCOMPACT_LINKS next_free and prev_free are 32 bit offsets instead
+ * of pointers, a free chunk needs 16 bytes instead of 24 (see Link).
+ *
+ * Requests of at most SLAB_MAX bytes are served from page sized slabs of
+ * equal slots without headers instead (see slab_alloc).
+ *
+ * Requests of at least MMAP_THRESHOLD bytes get a mapping of their own
+ * outside of the heap (see map_alloc).
+ *
+ * mm_memalign turns the space in front of an aligned payload into a free
+ * chunk (see heap_alloc_aligned).
+ *
+ * mm_malloc_batch carves many chunks out of one free chunk, mm_free_batch
+ * frees neighbouring chunks as one (see heap_malloc_batch).
+ *
+ * mm_halloc returns a handle to a block that mm_compact may slide down
+ * into the free chunk in front of it while it is not locked (see
+ * heap_compact).
+ *
+ * mm_arena_create makes a region that hands out memory from big blocks
+ * with a bump pointer and frees all of it at once (see mm_arena_alloc).
+ *
+ * With -DSTATS every thread counts requests, searches, splits, coalesces
+ * and heap growth, mm_stats sums them up (see STAT_ADD).
+ *
+ * The heap starts with the prev_size word of START (unused, START has the
+ * prev bit set as bottom boundary) and ends with the header of END
+ * (size 0, not free).
  *
  */
 
 #include <assert.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "config.h"
 #include "memlib.h"
 #include "mm.h"
 
+#ifdef THREADS
+#include <pthread.h>
+#endif
+
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
  * provide your team information in the following struct.
@@ -68,63 +119,465 @@ struct Chunk {
   char payload;
 };
 
+#ifdef COMPACT_LINKS
+/*
+ * free list links as 32 bit offsets from LINK_BASE, one word in front of
+ * mem_heap_lo() so that 0 is never a chunk and stands for NULL
+ * all regions are in one block of memlib, so an offset works in all arenas
+ */
+typedef unsigned Link;
+static char *LINK_BASE;
+#define TO_LINK(ptr) ((ptr) == NULL ? 0 : (Link)((char *)(ptr) - LINK_BASE))
+#define FROM_LINK(link) ((link) == 0 ? NULL : (void *)(LINK_BASE + (link)))
+/* the last chunk the region of the last arena can hold needs a link */
+#define LINKS_FIT()                                                            \
+  ((size_t)((char *)mem_region_lo(NUM_ARENAS - 1) + mem_max_heapsize() -      \
+            MIN_CHUNKSIZE - LINK_BASE) <= UINT_MAX)
+#else
+typedef void *Link;
+#define TO_LINK(ptr) ((Link)(ptr))
+#define FROM_LINK(link) (link)
+#endif
+
 typedef struct FreeChunk FreeChunk;
 struct FreeChunk {
   unsigned prev_size;
   unsigned header; // size and flagbits
-  FreeChunk *next_chunk;
-  FreeChunk *prev_chunk;
+  Link next_chunk;
+  Link prev_chunk;
   char payload;
 };
 
-/* GLOBAL VARIABLE
- * Easy Access and storing of Heapstart
+/* follow and set the links of a free chunk (or tree chunk) */
+#define NEXT_CHUNK(chunk) ((__typeof__(chunk))FROM_LINK((chunk)->next_chunk))
+#define PREV_CHUNK(chunk) ((__typeof__(chunk))FROM_LINK((chunk)->prev_chunk))
+#define SET_NEXT_CHUNK(chunk, ptr) ((chunk)->next_chunk = TO_LINK(ptr))
+#define SET_PREV_CHUNK(chunk, ptr) ((chunk)->prev_chunk = TO_LINK(ptr))
+
+/*
+ * free chunks of at least TREE_MIN bytes are nodes of a red black tree
+ * ordered by size. chunks of the same size hang off the tree node in the
+ * next_chunk/prev_chunk list, only the node itself has prev_chunk == NULL
+ */
+typedef struct TreeChunk TreeChunk;
+struct TreeChunk {
+  unsigned prev_size;
+  unsigned header; // size and flagbits
+  Link next_chunk;
+  Link prev_chunk;
+  TreeChunk *left;
+  TreeChunk *right;
+  TreeChunk *parent;
+  unsigned color;
+};
+
+/*
+ * a slab is the payload of a not free chunk that fills one aligned page.
+ * it starts with this struct, the rest of the page is cut in slots of
+ * slot_size bytes. freed slots are linked through their first word
  */
-static Chunk *START;
-static Chunk *END;
+typedef struct Slab Slab;
+struct Slab {
+  Slab *next_slab; // slabs of the same class with free slots
+  Slab *prev_slab;
+  void *free_slots;
+  unsigned slot_size;
+  unsigned used;     // slots handed out and not freed
+  unsigned carved;   // slots handed out at least once, the rest is untouched
+  unsigned capacity; // slots in the slab
+};
 
 // defined as global variable because this is being calculated often and stays
-// the same
-static unsigned MIN_CHUNKSIZE = (sizeof(unsigned) * 2) + ((sizeof(char *)) * 2);
+// the same, rounded up to ALIGNMENT
+static unsigned MIN_CHUNKSIZE =
+    ((sizeof(unsigned) * 2) + (sizeof(Link) * 2) + ALIGNMENT - 1) &
+    ~(ALIGNMENT - 1);
+
+#ifdef TLSF
+/*
+ * two level segregated fit (compile with -DTLSF)
+ * the first level splits sizes in powers of two, the second level splits
+ * every power of two range in SL_COUNT lists of the same width.
+ * chunks smaller than SMALL_SIZE all share first level 0 in steps of 8
+ * a bit is set in FL_BITMAP / SL_BITMAP for every non empty list
+ */
+#define SL_LOG2 4
+#define SL_COUNT (1 << SL_LOG2)
+#define SMALL_LOG2 (SL_LOG2 + 3)
+#define SMALL_SIZE (1 << SMALL_LOG2)
+#define FL_COUNT (32 - SMALL_LOG2 + 1)
+#define NUM_CLASSES (FL_COUNT * SL_COUNT)
+#else
+/*
+ * number of segregated free lists
+ * class 0 holds chunks smaller than 32 bytes, class n chunks in
+ * [2^(n+4), 2^(n+5)), everything from TREE_MIN on is in the tree
+ */
+#define NUM_CLASSES 6
+#define TREE_MIN 1024
+
+#define RED 1
+#define BLACK 0
+#endif
+
+#ifdef DEFER_COALESCE
+/*
+ * deferred coalescing (compile with -DDEFER_COALESCE)
+ * freed chunks of at most QUICK_MAX bytes go to the quick list of their
+ * exact size and stay marked as not free, so nothing coalesces with them
+ * and malloc takes them back as they are. they are coalesced and put into
+ * the free lists in one batch when no free chunk fits or QUICK_LIMIT
+ * chunks are waiting
+ */
+#define QUICK_MAX 512
+#define QUICK_BINS (QUICK_MAX / ALIGNMENT + 1)
+#ifndef QUICK_LIMIT
+#define QUICK_LIMIT 256
+#endif
+#endif
+
+/*
+ * placement policy of new heaps (mm.h, -DPLACEMENT=<policy>, mdriver -P)
+ * the policies choose among the chunks of the segregated lists (less than
+ * TREE_MIN bytes), slots of slabs are taken in order and the tree of big
+ * chunks is always searched with best fit. MM_GOOD_FIT takes the
+ * smallest of the first FIT_K chunks that fit. with -DTLSF only
+ * MM_FIRST_FIT (good fit of the bitmaps) and MM_ADDRESS_FIT are supported
+ */
+#ifndef PLACEMENT
+#define PLACEMENT MM_FIRST_FIT
+#endif
+#ifndef FIT_K
+#define FIT_K 8
+#endif
+
+/*
+ * the heap grows by at least GROW_MIN bytes, the rest of a growth stays
+ * a free chunk at the end of the heap. 0 grows by exactly what is missing
+ */
+#ifndef GROW_MIN
+#define GROW_MIN 0
+#endif
+
+/*
+ * a free last chunk of at least TRIM_THRESHOLD bytes is given back to
+ * memlib down to GROW_MIN bytes (or what mm_reserve asked for) whenever
+ * free creates it
+ */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128 * 1024)
+#endif
+
+/*
+ * requests of at least MMAP_THRESHOLD bytes get a mapping of their own
+ * instead of a chunk of the heap (see map_alloc)
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (128 * 1024)
+#endif
+
+/*
+ * how much a -DCHECKHEAP build checks (mm.h, -DCHECK_LEVEL=<level>,
+ * mdriver -c): MM_CHECK_LOCAL checks the chunks an op touches and their
+ * neighbours, MM_CHECK_EVERY_N scans the whole heap every CHECK_EVERY ops
+ * of an arena, MM_CHECK_FULL whenever a function leaves it consistent
+ */
+#ifndef CHECK_LEVEL
+#define CHECK_LEVEL MM_CHECK_LOCAL
+#endif
+#ifndef CHECK_EVERY
+#define CHECK_EVERY 1024
+#endif
+
+/*
+ * the first slab of a heap that already has chunks goes behind them, in a
+ * heap of less than SLAB_MIN_HEAP bytes the page and its alignment gap are
+ * a big share and the slab pins the end heap_realloc grows the last chunk
+ * into. small requests take chunks until the heap is that big
+ */
+#ifndef SLAB_MIN_HEAP
+#define SLAB_MIN_HEAP (64 * 1024)
+#endif
+
+/*
+ * blocks of a region arena (mm_arena_create) are ARENA_BLOCK bytes unless
+ * the region chooses another size, requests bigger than a quarter of a
+ * block get a block of their own
+ */
+#ifndef ARENA_BLOCK
+#define ARENA_BLOCK (64 * 1024)
+#endif
+
+/*
+ * requests of at most SLAB_MAX bytes come from slabs of SLAB_SIZE bytes,
+ * there is one slab class for every multiple of ALIGNMENT up to SLAB_MAX.
+ * slab_map has one bit for every page a region can have with the largest
+ * maximum heap size, only SLAB_MAP_USED bytes of it are ever touched
+ */
+#define SLAB_SIZE 4096
+#define SLAB_MAX 64
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)
+#define SLAB_MAP_BYTES ((MAX_HEAP_LIMIT / SLAB_SIZE + 8) / 8)
+#define SLAB_MAP_USED ((mem_max_heapsize() / SLAB_SIZE + 8) / 8)
+
+/* free bytes the trims of free and mm_compact keep at the end of a heap */
+#define AUTO_TRIM_PAD (arena->top_pad > GROW_MIN ? arena->top_pad : GROW_MIN)
+
+/*
+ * an arena is one independent heap in its own memlib region
+ * with its own START/END and free lists
+ */
+typedef struct Arena Arena;
+struct Arena {
+  Chunk *start;
+  Chunk *end;
+  // heads of the segregated free lists, NULL terminated
+  FreeChunk *free_lists[NUM_CLASSES];
+#ifdef TLSF
+  unsigned fl_bitmap;
+  unsigned sl_bitmap[FL_COUNT];
+#else
+  // root of the size ordered tree of big free chunks
+  TreeChunk *tree_root;
+  // where next fit continues in every size class
+  FreeChunk *rovers[NUM_CLASSES];
+#endif
+  int policy; // placement policy, set by heap_init
+#ifdef DEFER_COALESCE
+  // freed chunks waiting to be coalesced, linked through next_chunk
+  FreeChunk *quick_lists[QUICK_BINS];
+  unsigned quick_count;
+#endif
+  // slabs with free slots of every slab class
+  Slab *slabs[SLAB_CLASSES];
+  // slabs in the heap, full ones included
+  unsigned slab_count;
+  // bit set for every page of the region that is a slab
+  unsigned char slab_map[SLAB_MAP_BYTES];
+  uintptr_t first_page; // number of the page the region starts in
+  int region;           // memlib region of the heap
+#ifdef CHECKHEAP
+  unsigned ops; // ops since the last full scan (MM_CHECK_EVERY_N)
+#endif
+  // handle block heap_compact stopped behind, NULL to start at START
+  Chunk *compact_cursor;
+  // free bytes at the end of the heap that trims keep (heap_reserve)
+  size_t top_pad;
+#ifdef THREADS
+  pthread_mutex_t lock;
+  // chunks freed by threads of other arenas, pushed without the lock
+  FreeChunk *remote_frees;
+#endif
+};
+
+#ifdef THREADS
+#define NUM_ARENAS MEM_REGIONS
+#else
+#define NUM_ARENAS 1
+#endif
+
+/*
+ * a handle of mm_halloc, its block may move inside of its arena as long
+ * as it is not locked. the block starts with a pointer back to the handle
+ * in front of the bytes the caller gets (HANDLE_PAD)
+ */
+typedef struct mm_handle Handle;
+struct mm_handle {
+  char *ptr;       // what mm_hlock returns
+  Arena *arena;    // arena of the block
+  unsigned locks;  // mm_hlock calls without mm_hunlock
+};
+
+/* bytes in front of the caller's part of a handle block */
+#define HANDLE_PAD ALIGN(sizeof(Handle *))
+
+/* GLOBAL VARIABLE
+ * all arenas, arena 0 is the heap of mem_sbrk
+ */
+static Arena ARENAS[NUM_ARENAS];
+
+/* GLOBAL VARIABLE
+ * placement policy the next heap_init gives its arena (mm_set_policy)
+ */
+static int POLICY = PLACEMENT;
+
+#ifdef CHECKHEAP
+/* GLOBAL VARIABLE
+ * check level and full scan period of all arenas (mm_set_check)
+ */
+static int CHECK = CHECK_LEVEL;
+static unsigned CHECK_PERIOD = CHECK_EVERY;
+#endif
+
+#ifdef STATS
+/*
+ * counters of mm_stats, every thread counts into its own copy (one
+ * thread with THREADS off) so counting needs no lock and no atomic add.
+ * stores are relaxed atomics because mm_stats reads them from another
+ * thread, only the owner ever writes them
+ */
+#define STAT_ADD(field, n)                                                     \
+  do {                                                                         \
+    mm_counters_t *c_ = counters();                                            \
+    __atomic_store_n(&c_->field, c_->field + (n), __ATOMIC_RELAXED);           \
+  } while (0)
+
+/* size class of mm_stats (mm.h): up to 16 << class bytes */
+static inline int stat_class(size_t size) {
+  int cls = 0;
+
+  while (cls < MM_STAT_CLASSES - 1 && size > ((size_t)16 << cls))
+    cls++;
+  return cls;
+}
+
+#ifdef THREADS
+typedef struct ThreadCounters ThreadCounters;
+struct ThreadCounters {
+  mm_counters_t count;
+  ThreadCounters *next; // in ALL_COUNTERS
+  int linked;
+};
+
+/* GLOBAL VARIABLE
+ * counters of this thread, linked into ALL_COUNTERS by its first count
+ */
+static __thread ThreadCounters COUNTERS;
+
+/* GLOBAL VARIABLE
+ * counters of all running threads that counted and the sum of the
+ * counters of the threads that exited, guarded by COUNTERS_LOCK
+ */
+static ThreadCounters *ALL_COUNTERS;
+static mm_counters_t EXITED_COUNTERS;
+static pthread_mutex_t COUNTERS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t COUNTERS_KEY;
+static pthread_once_t COUNTERS_ONCE = PTHREAD_ONCE_INIT;
+
+/* adds the counters in add to sum, both are arrays of unsigned long */
+static void add_counters(mm_counters_t *sum, mm_counters_t *add) {
+  unsigned long *s = (unsigned long *)sum;
+  unsigned long *a = (unsigned long *)add;
+
+  for (size_t i = 0; i < sizeof(mm_counters_t) / sizeof(unsigned long); i++)
+    s[i] += __atomic_load_n(&a[i], __ATOMIC_RELAXED);
+}
+
+/* thread exit: keeps the counts in EXITED_COUNTERS */
+static void counters_release(void *arg) {
+  ThreadCounters *mine = arg, **link;
+
+  pthread_mutex_lock(&COUNTERS_LOCK);
+  add_counters(&EXITED_COUNTERS, &mine->count);
+  for (link = &ALL_COUNTERS; *link != NULL; link = &(*link)->next)
+    if (*link == mine) {
+      *link = mine->next;
+      break;
+    }
+  pthread_mutex_unlock(&COUNTERS_LOCK);
+}
+
+static void counters_key_init(void) {
+  pthread_key_create(&COUNTERS_KEY, counters_release);
+}
+
+static void link_counters(void) {
+  pthread_once(&COUNTERS_ONCE, counters_key_init);
+  pthread_mutex_lock(&COUNTERS_LOCK);
+  COUNTERS.next = ALL_COUNTERS;
+  ALL_COUNTERS = &COUNTERS;
+  COUNTERS.linked = 1;
+  pthread_mutex_unlock(&COUNTERS_LOCK);
+  pthread_setspecific(COUNTERS_KEY, &COUNTERS);
+}
+
+static inline mm_counters_t *counters(void) {
+  if (!COUNTERS.linked)
+    link_counters();
+  return &COUNTERS.count;
+}
+
+/* mm_init: every thread counts from 0 again */
+static void reset_counters(void) {
+  pthread_mutex_lock(&COUNTERS_LOCK);
+  memset(&EXITED_COUNTERS, 0, sizeof(EXITED_COUNTERS));
+  for (ThreadCounters *c = ALL_COUNTERS; c != NULL; c = c->next)
+    memset(&c->count, 0, sizeof(c->count));
+  pthread_mutex_unlock(&COUNTERS_LOCK);
+}
+
+/* the counts of all threads, running and exited */
+static void sum_counters(mm_counters_t *sum) {
+  pthread_mutex_lock(&COUNTERS_LOCK);
+  add_counters(sum, &EXITED_COUNTERS);
+  for (ThreadCounters *c = ALL_COUNTERS; c != NULL; c = c->next)
+    add_counters(sum, &c->count);
+  pthread_mutex_unlock(&COUNTERS_LOCK);
+}
+#else
+/* GLOBAL VARIABLE
+ * counters of mm_stats
+ */
+static mm_counters_t COUNTERS;
+
+static inline mm_counters_t *counters(void) { return &COUNTERS; }
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+static void reset_counters(void) { memset(&COUNTERS, 0, sizeof(COUNTERS)); }
 
-#define WORDSZ 8
+static void sum_counters(mm_counters_t *sum) { *sum = COUNTERS; }
+#endif
+#else
+#define STAT_ADD(field, n) ((void)0)
+#endif
+
+/*
+ * Easy Access to the heap of the arena the function works on,
+ * every function that uses these has an Arena *arena
+ */
+#define START (arena->start)
+#define END (arena->end)
+#define FREE_LISTS (arena->free_lists)
+#define FL_BITMAP (arena->fl_bitmap)
+#define SL_BITMAP (arena->sl_bitmap)
+#define TREE_ROOT (arena->tree_root)
+#define ROVERS (arena->rovers)
+#define QUICK_LISTS (arena->quick_lists)
+#define SLABS (arena->slabs)
+#define SLAB_MAP (arena->slab_map)
+
+/* rounds up to the nearest multiple of ALIGNMENT (config.h, 8 or 16) */
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
 
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+/*
+ * the heap starts START_PAD bytes into its region, so that START and
+ * every chunk after it (all sizes are multiples of ALIGNMENT) have an
+ * ALIGNMENT aligned payload
+ */
+#define START_PAD (ALIGNMENT - 2 * sizeof(unsigned))
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+/* largest request a chunk of the heap can hold, its size is unsigned */
+#define CHUNK_MAX_REQUEST ((size_t)UINT_MAX - 2 * ALIGNMENT)
 
 /*
- * Calculate the Size of a Chunk with just the payload
+ * Calculate the Size of a Chunk with just the payload, the header is the
+ * only overhead of a not free chunk
  * IMPORTANT: Check if bigger than CHUNKMINSIZE
  */
 #define CALC_CHUNK_SIZE(payloadsize)                                           \
-  (((unsigned)(ALIGN(payloadsize))) + ((unsigned)(sizeof(unsigned) * 2)))
+  ((unsigned)(ALIGN((payloadsize) + sizeof(unsigned))))
 
 /* calculate the payloadsize from size including overhead */
-#define PAYLOADSIZE_FROM_CHUNKSIZE(chunksize)                                  \
-  (chunksize - (2 * sizeof(unsigned)))
-
-/* get pointer to header of chunk from payload pointer */
-#define PAYLOAD_TO_CHUNKPTR(payload_pointer)                                   \
-  ((void *)((unsigned *)payload_pointer) - 1)
+#define PAYLOADSIZE_FROM_CHUNKSIZE(chunksize) (chunksize - sizeof(unsigned))
 
 /* get pointer of type chunk from payload pointer */
 #define PAYLOAD_TO_CHUNKSTRUCT_PTR(payload_pointer)                            \
-  ((Chunk *)(((unsigned *)payload_pointer) - 2))
+  ((Chunk *)(((unsigned *)(payload_pointer)) - 2))
 
-/* get pointer of tupe chunk from chunk pointer */
-#define CHUNKPTR_TO_CHUNKSTRUCT_PTR(chunkptr)                                  \
-  ((Chunk *)(((unsigned *)chunkptr) - 1))
-
-/* get the freebit of a header */
+/* get the freebit of a header (0 means free) */
 #define GET_FREEBIT(header) (((unsigned)header) & 0b1)
 
 /* get the sizebits of a header */
-#define GET_SIZEBIT(header) (((unsigned)header) & ~0x1)
+#define GET_SIZEBIT(header) (((unsigned)header) & ~0x7)
 
 /* sets the freebit to 0 */
 #define SET_ISFREE(header) (header &= ~0b1)
@@ -132,60 +585,78 @@ static unsigned MIN_CHUNKSIZE = (sizeof(unsigned) * 2) + ((sizeof(char *)) * 2);
 /* sets the freebit to 1 */
 #define SET_NOTFREE(header) (header |= 0b1)
 
-// set the size of chunk
-#define SET_SIZEBIT(header, size) (header |= ((unsigned)size) << 0b1)
+/* get the handle bit of a header (set for the blocks of mm_halloc) */
+#define GET_HANDLEBIT(header) (((unsigned)header) & 0b100)
 
-/*
- * gives header pointer of next chunk
- * takes pointer to header
- */
-#define JUMP_NEXT_CHUNK(chunkptr)                                              \
-  ((unsigned *)((char *)chunkptr) + GET_SIZEBIT(*(unsigned *)(chunkptr)))
+/* sets the handle bit to 1 */
+#define SET_HANDLEBIT(header) (header |= 0b100)
 
-/* gives header pointer of prev chunk
- * takes pointer to header
- */
-#define JUMP_PREV_CHUNK(chunkptr)                                              \
-  (((unsigned *)((char *)chunkptr) - GET_SIZEBIT(*(unsigned *)chunkptr - 1)) + \
-   1)
+/* sets the handle bit to 0 */
+#define CLEAR_HANDLEBIT(header) (header &= ~0b100)
 
-/* set the size of block - abstracted */
-static inline void set_size(unsigned *header, unsigned payload_size) {
-  unsigned aligned = ALIGN(payload_size);
-  if (aligned >= MIN_CHUNKSIZE) {
-    SET_SIZEBIT(*header, CALC_CHUNK_SIZE(aligned));
-  } else {
-    SET_SIZEBIT(*header, MIN_CHUNKSIZE);
-  }
-}
+/* get the prev bit of a header (0 means the chunk before is free) */
+#define GET_PREVBIT(header) (((unsigned)header) & 0b10)
+
+/* the prev bit a chunk after a chunk with this header needs */
+#define PREVBIT_OF(header) (GET_FREEBIT(header) << 1)
+
+// set the size of chunk, keeps the flagbits
+#define SET_SIZEBIT(header, size) (header = (header & 0x7) | ((unsigned)size))
 
 /* gives pointer to next chunk struct
  * takes pointer to chunk struct
  */
 #define JUMP_NEXT_FROM_STRUCT(structptr)                                       \
-  ((Chunk *)(((char *)structptr) + (GET_SIZEBIT(*((unsigned *)structptr + 1)))))
+  ((Chunk *)(((char *)structptr) + GET_SIZEBIT(((Chunk *)structptr)->header)))
 
 /* gives pointer to prev chunk struct
  * takes pointer to chunk struct
  */
 #define JUMP_PREV_FROM_STRUCT(structptr)                                       \
-  ((Chunk *)((char *)structptr) - GET_SIZEBIT(*(unsigned *)structptr))
+  ((Chunk *)(((char *)structptr) -                                             \
+             GET_SIZEBIT(((Chunk *)structptr)->prev_size)))
+
+/*
+ * set the footer of a free chunk (the prev_size of the next chunk)
+ * takes pointer to chunk struct
+ */
+#define SET_FOOTER(structptr, value)                                           \
+  ((JUMP_NEXT_FROM_STRUCT(structptr))->prev_size = (value))
 
 /*
- * get the setbit of the chunk after the payload.
- * for easy access of nextchunk to this chunk
- * takes pointer to header of current chunk
+ * set the prev bit of the next chunk to the free state of the chunk
+ * takes pointer to chunk struct
  */
-#define SET_FOOTER(structptr, size)                                            \
-  SET_SIZEBIT(((JUMP_NEXT_FROM_STRUCT(structptr))->prev_size), size)
+#define SET_NEXT_PREVBIT(structptr)                                            \
+  (JUMP_NEXT_FROM_STRUCT(structptr)->header =                                  \
+       (JUMP_NEXT_FROM_STRUCT(structptr)->header & ~0b10) |                    \
+       PREVBIT_OF(((Chunk *)structptr)->header))
 
 // set chunk after structptr to the last chunk in heap (size 0)
 #define SET_LASTCHUNK(structptr)                                               \
   Chunk *last_chunk = JUMP_NEXT_FROM_STRUCT(structptr);                        \
+  last_chunk->header = PREVBIT_OF(((Chunk *)structptr)->header);               \
   SET_NOTFREE(last_chunk->header);                                             \
-  SET_SIZEBIT(last_chunk->header, 0);                                          \
   END = last_chunk;
 
+/* page index of an address in the slab map of its arena */
+#define SLAB_PAGE(ptr) ((uintptr_t)(ptr) / SLAB_SIZE - arena->first_page)
+
+/*
+ * is the pointer a slot of a slab, the map is read atomically because
+ * mm_free of other threads reads it without the lock of the arena
+ */
+#define IS_SLAB(ptr)                                                           \
+  ((__atomic_load_n(&SLAB_MAP[SLAB_PAGE(ptr) / 8], __ATOMIC_RELAXED) >>        \
+    (SLAB_PAGE(ptr) % 8)) &                                                    \
+   1)
+
+/* the slab a slot belongs to */
+#define SLAB_OF(ptr) ((Slab *)((uintptr_t)(ptr) & ~(uintptr_t)(SLAB_SIZE - 1)))
+
+/* size of the Slab struct in front of the first slot */
+#define SLAB_HEADER ALIGN(sizeof(Slab))
+
 /*
  * ---------------------------------
  * functions
@@ -193,274 +664,2826 @@ static inline void set_size(unsigned *header, unsigned payload_size) {
  */
 
 int mm_check(int line_num);
+static int check_arena(Arena *arena, int line_num);
+#ifdef CHECKHEAP
+static void check_op(Arena *arena, int line_num);
+static void check_full(Arena *arena, int line_num);
+static void check_chunk(Arena *arena, Chunk *chunk, int line_num);
+static void check_free_size(void *ptr, size_t size, int mapped);
+#endif
+static void *slab_alloc(Arena *arena, size_t size);
+static int heap_trim(Arena *arena, size_t pad);
+static void slab_free(Arena *arena, void *ptr);
+
+#ifdef TLSF
+/* index of the highest set bit */
+#define FLS(x) (31 - __builtin_clz(x))
+
+/* index of the lowest set bit */
+#define FFS(x) (__builtin_ctz(x))
 
 /*
- * mm_init - initialize the malloc package.
- * initialises start and end pointer
- * puts 1 freeblock and the end guard block
- * freeblock pointers point to itself (circular list)
+ * gives the size class (first level * SL_COUNT + second level) of a
+ * chunk size, rounded down
  */
-int mm_init(void) {
+static inline int size_class(unsigned size) {
+  if (size < SMALL_SIZE)
+    return size >> 3;
 
-  int size_of_first_chunk = MIN_CHUNKSIZE;
-  int size_of_last_chunk = sizeof(Chunk);
+  int fl = FLS(size);
+  int sl = (size >> (fl - SL_LOG2)) ^ SL_COUNT;
 
-  void *heap = mem_sbrk(size_of_first_chunk + size_of_last_chunk + 8);
+  return (fl - SMALL_LOG2 + 1) * SL_COUNT + sl;
+}
+#else
+/*
+ * gives the size class of a chunk size
+ */
+static inline int size_class(unsigned size) {
+  int cls = (31 - __builtin_clz(size | 1)) - 4;
+
+  if (cls < 0)
+    return 0;
+  if (cls >= NUM_CLASSES)
+    return NUM_CLASSES - 1;
+  return cls;
+}
+#endif
 
-  // Check if sbrk was successfull
-  if (heap == (void *)-1) {
-    return -1;
-  }
+#ifndef TLSF
+/*
+ * ---------------------------------
+ * red black tree for the big free chunks
+ * ---------------------------------
+ */
 
-  // this is fine here because prev_size = 0 is the bottom boundary of the heap
-  FreeChunk *first_chunk = (FreeChunk *)heap;
+#define TREE_SIZE(node) GET_SIZEBIT((node)->header)
 
-  // bottom boundary
-  first_chunk->prev_size = 1;
+#define IS_RED(node) ((node) != NULL && (node)->color == RED)
 
-  SET_ISFREE(first_chunk->header);
-  SET_SIZEBIT(first_chunk->header, size_of_first_chunk);
-  first_chunk->next_chunk = first_chunk;
-  first_chunk->prev_chunk = first_chunk;
+/* make new take the place of old below parent */
+static inline void replace_child(Arena *arena, TreeChunk *parent,
+                                 TreeChunk *old, TreeChunk *new) {
+  if (parent == NULL)
+    TREE_ROOT = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
 
-  START = (Chunk *)first_chunk;
-  END = JUMP_NEXT_FROM_STRUCT(START);
+static void rotate_left(Arena *arena, TreeChunk *node) {
+  TreeChunk *right = node->right;
 
-  SET_LASTCHUNK(first_chunk);
+  node->right = right->left;
+  if (right->left != NULL)
+    right->left->parent = node;
+  right->parent = node->parent;
+  replace_child(arena, node->parent, node, right);
+  right->left = node;
+  node->parent = right;
+}
 
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
-#endif
+static void rotate_right(Arena *arena, TreeChunk *node) {
+  TreeChunk *left = node->left;
 
-  return 0;
+  node->left = left->right;
+  if (left->right != NULL)
+    left->right->parent = node;
+  left->parent = node->parent;
+  replace_child(arena, node->parent, node, left);
+  left->right = node;
+  node->parent = left;
 }
 
 /*
- * first fit algorithm for malloc
- * finds the first chunk that is big enough for size
- *
- * Null if not found
+ * insert a free chunk into the tree
+ * a chunk with a size that is already in the tree goes into the list of
+ * that node and the tree is not touched
  */
-FreeChunk *first_fit(size_t size) {
-
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
-#endif
-
-  Chunk *find = START;
-
-  while (GET_FREEBIT(find->header) == 1 && find != END) {
-    find = JUMP_NEXT_FROM_STRUCT(find);
+static void insert_tree(Arena *arena, TreeChunk *node) {
+  unsigned size = TREE_SIZE(node);
+  TreeChunk *parent = NULL;
+  TreeChunk *current = TREE_ROOT;
+
+  SET_PREV_CHUNK(node, NULL);
+  SET_NEXT_CHUNK(node, NULL);
+  node->left = NULL;
+  node->right = NULL;
+
+  while (current != NULL) {
+    if (size == TREE_SIZE(current)) {
+      SET_PREV_CHUNK(node, current);
+      node->next_chunk = current->next_chunk;
+      if (NEXT_CHUNK(current) != NULL)
+        SET_PREV_CHUNK(NEXT_CHUNK(current), node);
+      SET_NEXT_CHUNK(current, node);
+      return;
+    }
+    parent = current;
+    current = (size < TREE_SIZE(current)) ? current->left : current->right;
   }
 
-  if (find == END) {
-    return NULL;
-  } else {
-    // available free block
-    FreeChunk *current = (FreeChunk *)find;
-
-    while (PAYLOADSIZE_FROM_CHUNKSIZE(GET_SIZEBIT(current->header)) < size) {
-      if (current->next_chunk == (FreeChunk *)find) {
-        return NULL;
+  node->parent = parent;
+  node->color = RED;
+  if (parent == NULL)
+    TREE_ROOT = node;
+  else if (size < TREE_SIZE(parent))
+    parent->left = node;
+  else
+    parent->right = node;
+
+  // repair red nodes with red parents
+  while (IS_RED(node->parent)) {
+    parent = node->parent;
+    TreeChunk *grand = parent->parent;
+
+    if (parent == grand->left) {
+      TreeChunk *uncle = grand->right;
+      if (IS_RED(uncle)) {
+        parent->color = BLACK;
+        uncle->color = BLACK;
+        grand->color = RED;
+        node = grand;
+        continue;
+      }
+      if (node == parent->right) {
+        rotate_left(arena, parent);
+        node = parent;
+        parent = node->parent;
       }
-      current = current->next_chunk;
+      parent->color = BLACK;
+      grand->color = RED;
+      rotate_right(arena, grand);
+    } else {
+      TreeChunk *uncle = grand->left;
+      if (IS_RED(uncle)) {
+        parent->color = BLACK;
+        uncle->color = BLACK;
+        grand->color = RED;
+        node = grand;
+        continue;
+      }
+      if (node == parent->left) {
+        rotate_right(arena, parent);
+        node = parent;
+        parent = node->parent;
+      }
+      parent->color = BLACK;
+      grand->color = RED;
+      rotate_left(arena, grand);
     }
-
-    return current;
   }
-
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
-#endif
+  TREE_ROOT->color = BLACK;
 }
 
 /*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
- *
- * if no free chunk is available for this -> ask for more memory from system
- * if free chunk is available -> try to split the chunk and repair the freelist
+ * restore the black height after a black node was removed
+ * node took its place and may be NULL, so its parent is passed as well
  */
-void *mm_malloc(size_t size) {
-
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
-#endif
-
-  FreeChunk *fit = first_fit(size);
-
-  // no free chunks available
-  if (fit == NULL) {
-    int newsize = CALC_CHUNK_SIZE(size);
-    if (newsize < MIN_CHUNKSIZE)
-      newsize = MIN_CHUNKSIZE;
-    void *p = mem_sbrk(newsize);
-
-    if (p == (void *)-1) {
-      return NULL;
+static void remove_tree_fixup(Arena *arena, TreeChunk *node,
+                              TreeChunk *parent) {
+  while (node != TREE_ROOT && !IS_RED(node)) {
+    if (node == parent->left) {
+      TreeChunk *sibling = parent->right;
+      if (IS_RED(sibling)) {
+        sibling->color = BLACK;
+        parent->color = RED;
+        rotate_left(arena, parent);
+        sibling = parent->right;
+      }
+      if (!IS_RED(sibling->left) && !IS_RED(sibling->right)) {
+        sibling->color = RED;
+        node = parent;
+        parent = node->parent;
+      } else {
+        if (!IS_RED(sibling->right)) {
+          sibling->left->color = BLACK;
+          sibling->color = RED;
+          rotate_right(arena, sibling);
+          sibling = parent->right;
+        }
+        sibling->color = parent->color;
+        parent->color = BLACK;
+        sibling->right->color = BLACK;
+        rotate_left(arena, parent);
+        node = TREE_ROOT;
+      }
     } else {
-      Chunk *new_chunk = END;
-      SET_SIZEBIT(new_chunk->header, newsize);
-      SET_NOTFREE(new_chunk->header);
-
-      SET_LASTCHUNK(new_chunk);
-      return &new_chunk->payload;
+      TreeChunk *sibling = parent->left;
+      if (IS_RED(sibling)) {
+        sibling->color = BLACK;
+        parent->color = RED;
+        rotate_right(arena, parent);
+        sibling = parent->left;
+      }
+      if (!IS_RED(sibling->left) && !IS_RED(sibling->right)) {
+        sibling->color = RED;
+        node = parent;
+        parent = node->parent;
+      } else {
+        if (!IS_RED(sibling->left)) {
+          sibling->right->color = BLACK;
+          sibling->color = RED;
+          rotate_left(arena, sibling);
+          sibling = parent->left;
+        }
+        sibling->color = parent->color;
+        parent->color = BLACK;
+        sibling->left->color = BLACK;
+        rotate_right(arena, parent);
+        node = TREE_ROOT;
+      }
     }
-    // free chunks available
-  } else {
-
-    unsigned oldsize = GET_SIZEBIT(fit->header);
-    unsigned calcedsize = CALC_CHUNK_SIZE(size);
-    if (calcedsize < MIN_CHUNKSIZE)
-      calcedsize = MIN_CHUNKSIZE;
+  }
+  if (node != NULL)
+    node->color = BLACK;
+}
 
-    if (GET_SIZEBIT(fit->header) >= (calcedsize + MIN_CHUNKSIZE)) {
-      // split
+/*
+ * remove a free chunk from the tree
+ * chunks in the list of a node are simply unlinked, a node with a list
+ * is replaced by the first chunk of its list
+ */
+static void remove_tree(Arena *arena, TreeChunk *node) {
+  if (PREV_CHUNK(node) != NULL) {
+    PREV_CHUNK(node)->next_chunk = node->next_chunk;
+    if (NEXT_CHUNK(node) != NULL)
+      NEXT_CHUNK(node)->prev_chunk = node->prev_chunk;
+    return;
+  }
 
-      SET_SIZEBIT(fit->header, calcedsize);
-      SET_NOTFREE(fit->header);
+  if (NEXT_CHUNK(node) != NULL) {
+    TreeChunk *same = NEXT_CHUNK(node);
+    SET_PREV_CHUNK(same, NULL);
+    same->left = node->left;
+    same->right = node->right;
+    same->parent = node->parent;
+    same->color = node->color;
+    if (same->left != NULL)
+      same->left->parent = same;
+    if (same->right != NULL)
+      same->right->parent = same;
+    replace_child(arena, node->parent, node, same);
+    return;
+  }
 
-      FreeChunk *new_split = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(fit);
+  TreeChunk *child;
+  TreeChunk *parent;
+  unsigned color;
 
-      new_split->prev_size = fit->header;
-      SET_SIZEBIT(new_split->header, oldsize - calcedsize);
-      SET_ISFREE(new_split->header);
-      SET_FOOTER(new_split, new_split->header);
+  if (node->left != NULL && node->right != NULL) {
+    // the smallest node of the right subtree takes the place of node
+    TreeChunk *succ = node->right;
+    while (succ->left != NULL)
+      succ = succ->left;
 
-      new_split->next_chunk = fit->next_chunk;
-      new_split->prev_chunk = fit->prev_chunk;
+    child = succ->right;
+    parent = succ->parent;
+    color = succ->color;
 
+    if (parent == node) {
+      parent = succ;
     } else {
-      // dont split
-
-      fit->prev_chunk->next_chunk = fit->next_chunk;
-      fit->next_chunk->prev_chunk = fit->prev_chunk;
-
-      SET_NOTFREE(fit->header);
-      SET_FOOTER(fit, fit->header);
+      if (child != NULL)
+        child->parent = parent;
+      parent->left = child;
+      succ->right = node->right;
+      node->right->parent = succ;
     }
 
-    return (void *)(((unsigned *)fit) + 1);
+    succ->parent = node->parent;
+    succ->left = node->left;
+    node->left->parent = succ;
+    succ->color = node->color;
+    replace_child(arena, node->parent, node, succ);
+  } else {
+    child = (node->left != NULL) ? node->left : node->right;
+    parent = node->parent;
+    color = node->color;
+    if (child != NULL)
+      child->parent = parent;
+    replace_child(arena, parent, node, child);
   }
+
+  if (color == BLACK)
+    remove_tree_fixup(arena, child, parent);
 }
 
 /*
- * coalesces two chunks of memory and repairs the linked list
+ * best fit in the tree: the smallest chunk with at least size bytes
+ * prefers a chunk from the list of the node so the tree stays untouched
+ *
+ * Null if not found
  */
-inline void coalesc(FreeChunk *first, FreeChunk *second) {
+static FreeChunk *tree_fit(Arena *arena, unsigned size) {
+  TreeChunk *best = NULL;
+  TreeChunk *current = TREE_ROOT;
+
+  while (current != NULL) {
+    STAT_ADD(visited, 1);
+    if (TREE_SIZE(current) == size) {
+      best = current;
+      break;
+    }
+    if (TREE_SIZE(current) > size) {
+      best = current;
+      current = current->left;
+    } else {
+      current = current->right;
+    }
+  }
 
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
+  if (best != NULL && NEXT_CHUNK(best) != NULL)
+    return (FreeChunk *)NEXT_CHUNK(best);
+  return (FreeChunk *)best;
+}
 #endif
 
-  unsigned new_size = GET_SIZEBIT(first->header) + GET_SIZEBIT(second->header);
+/*
+ * insert a free chunk at the head of its size class, with MM_ADDRESS_FIT
+ * in front of the first chunk with a higher address
+ */
+static inline void insert_free(Arena *arena, FreeChunk *chunk) {
+#ifndef TLSF
+  if (GET_SIZEBIT(chunk->header) >= TREE_MIN) {
+    insert_tree(arena, (TreeChunk *)chunk);
+    return;
+  }
+#endif
 
-  SET_SIZEBIT(first->header, new_size);
-  SET_FOOTER(first, new_size);
+  FreeChunk **head = &FREE_LISTS[size_class(GET_SIZEBIT(chunk->header))];
+  FreeChunk *prev = NULL;
+  FreeChunk *next = *head;
 
-  second->next_chunk->prev_chunk = second->prev_chunk;
-  second->prev_chunk->next_chunk = second->next_chunk;
+  if (arena->policy == MM_ADDRESS_FIT) {
+    while (next != NULL && next < chunk) {
+      prev = next;
+      next = NEXT_CHUNK(next);
+    }
+  }
 
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
+  SET_PREV_CHUNK(chunk, prev);
+  SET_NEXT_CHUNK(chunk, next);
+  if (next != NULL)
+    SET_PREV_CHUNK(next, chunk);
+  if (prev != NULL)
+    SET_NEXT_CHUNK(prev, chunk);
+  else
+    *head = chunk;
+
+#ifdef TLSF
+  int cls = head - FREE_LISTS;
+  FL_BITMAP |= 1u << (cls / SL_COUNT);
+  SL_BITMAP[cls / SL_COUNT] |= 1u << (cls % SL_COUNT);
 #endif
 }
 
+/* unlink a free chunk from its size class */
+static inline void remove_free(Arena *arena, FreeChunk *chunk) {
+#ifndef TLSF
+  if (GET_SIZEBIT(chunk->header) >= TREE_MIN) {
+    remove_tree(arena, (TreeChunk *)chunk);
+    return;
+  }
+#endif
+
+  if (PREV_CHUNK(chunk) != NULL) {
+    PREV_CHUNK(chunk)->next_chunk = chunk->next_chunk;
+  } else {
+    int cls = size_class(GET_SIZEBIT(chunk->header));
+    FREE_LISTS[cls] = NEXT_CHUNK(chunk);
+
+#ifdef TLSF
+    if (FREE_LISTS[cls] == NULL) {
+      SL_BITMAP[cls / SL_COUNT] &= ~(1u << (cls % SL_COUNT));
+      if (SL_BITMAP[cls / SL_COUNT] == 0)
+        FL_BITMAP &= ~(1u << (cls / SL_COUNT));
+    }
+#endif
+  }
+
+  if (NEXT_CHUNK(chunk) != NULL)
+    NEXT_CHUNK(chunk)->prev_chunk = chunk->prev_chunk;
+
+#ifndef TLSF
+  if (arena->policy == MM_NEXT_FIT) {
+    FreeChunk **rover = &ROVERS[size_class(GET_SIZEBIT(chunk->header))];
+    if (*rover == chunk)
+      *rover = NEXT_CHUNK(chunk);
+  }
+#endif
+}
+
+/* chunk size that is needed for a request of size payload bytes */
+static inline unsigned request_size(size_t size) {
+  unsigned calcedsize = CALC_CHUNK_SIZE(size);
+  if (calcedsize < MIN_CHUNKSIZE)
+    calcedsize = MIN_CHUNKSIZE;
+  return calcedsize;
+}
+
+/*
+ * heap_init - initialize the malloc package.
+ * initialises start and end pointer
+ * the heap only holds the bottom boundary and the end guard block
+ * all free lists are empty
+ */
+static int heap_init(Arena *arena) {
+
+  void *heap =
+      mem_region_sbrk(arena->region, START_PAD + 2 * sizeof(unsigned));
+
+  // Check if sbrk was successfull
+  if (heap == (void *)-1) {
+    return -1;
+  }
+  STAT_ADD(sbrks, 1);
+  STAT_ADD(sbrk_bytes, START_PAD + 2 * sizeof(unsigned));
+
+  START = (Chunk *)((char *)heap + START_PAD);
+
+  // bottom boundary, the chunk before START looks like a not free chunk
+  END = START;
+  END->header = 0b10;
+  SET_NOTFREE(END->header);
+
+  memset(FREE_LISTS, 0, sizeof(FREE_LISTS));
+#ifdef TLSF
+  FL_BITMAP = 0;
+  memset(SL_BITMAP, 0, sizeof(SL_BITMAP));
+#else
+  TREE_ROOT = NULL;
+  memset(ROVERS, 0, sizeof(ROVERS));
+#endif
+  arena->policy = POLICY;
+  arena->compact_cursor = NULL;
+  arena->top_pad = 0;
+#ifdef DEFER_COALESCE
+  memset(QUICK_LISTS, 0, sizeof(QUICK_LISTS));
+  arena->quick_count = 0;
+#endif
+  memset(SLABS, 0, sizeof(SLABS));
+  arena->slab_count = 0;
+  memset(SLAB_MAP, 0, SLAB_MAP_USED);
+  arena->first_page = (uintptr_t)heap / SLAB_SIZE;
+
+#ifdef CHECKHEAP
+  check_full(arena, __LINE__);
+#endif
+
+  return 0;
+}
+
+#ifdef TLSF
+/*
+ * good fit in constant time for malloc
+ * size is the full chunk size that is needed
+ *
+ * size is rounded up to the next second level list, so the head of that
+ * list or of any non empty list after it is big enough.
+ * the lists are found with find first set on the bitmaps, no list is scanned
+ * if nothing is found the head of the list of size itself is tried before
+ * the heap has to grow
+ *
+ * Null if not found
+ */
+static FreeChunk *first_fit(Arena *arena, unsigned size) {
+
+  STAT_ADD(searches, 1);
+  STAT_ADD(visited, 1);
+  unsigned rounded = size;
+  if (size >= SMALL_SIZE)
+    rounded += (1u << (FLS(size) - SL_LOG2)) - 1;
+
+  int cls = size_class(rounded);
+  int fl = cls / SL_COUNT;
+  unsigned sl_map = SL_BITMAP[fl] & (~0u << (cls % SL_COUNT));
+
+  if (sl_map == 0) {
+    unsigned fl_map = FL_BITMAP & (~0u << (fl + 1));
+    if (fl_map == 0) {
+      FreeChunk *head = FREE_LISTS[size_class(size)];
+      if (head != NULL && GET_SIZEBIT(head->header) >= size)
+        return head;
+      return NULL;
+    }
+
+    fl = FFS(fl_map);
+    sl_map = SL_BITMAP[fl];
+  }
+
+  return FREE_LISTS[fl * SL_COUNT + FFS(sl_map)];
+}
+#else
+/*
+ * next fit in the lists: like first fit, but every size class is searched
+ * from its rover (the chunk after the last one taken) and wraps around
+ *
+ * Null if not found
+ */
+static FreeChunk *next_fit(Arena *arena, unsigned size) {
+  int cls = size_class(size);
+  FreeChunk *rover = ROVERS[cls] != NULL ? ROVERS[cls] : FREE_LISTS[cls];
+  FreeChunk *fit = NULL;
+
+  for (FreeChunk *current = rover; current != NULL && fit == NULL;
+       current = NEXT_CHUNK(current)) {
+    STAT_ADD(visited, 1);
+    if (GET_SIZEBIT(current->header) >= size)
+      fit = current;
+  }
+  for (FreeChunk *current = FREE_LISTS[cls]; current != rover && fit == NULL;
+       current = NEXT_CHUNK(current)) {
+    STAT_ADD(visited, 1);
+    if (GET_SIZEBIT(current->header) >= size)
+      fit = current;
+  }
+
+  for (cls++; cls < NUM_CLASSES && fit == NULL; cls++)
+    fit = ROVERS[cls] != NULL ? ROVERS[cls] : FREE_LISTS[cls];
+
+  if (fit == NULL)
+    return tree_fit(arena, size);
+
+  // remove_free moves the rover on to the next chunk
+  ROVERS[size_class(GET_SIZEBIT(fit->header))] = fit;
+  return fit;
+}
+
+/*
+ * best fit in the lists: the smallest of the first limit chunks with at
+ * least size bytes. every chunk of a bigger class is bigger, so the search
+ * stops at the first class with a chunk that fits
+ *
+ * Null if not found
+ */
+static FreeChunk *best_fit(Arena *arena, unsigned size, unsigned limit) {
+  FreeChunk *best = NULL;
+
+  for (int cls = size_class(size); cls < NUM_CLASSES && best == NULL; cls++) {
+    for (FreeChunk *current = FREE_LISTS[cls]; current != NULL;
+         current = NEXT_CHUNK(current)) {
+      unsigned current_size = GET_SIZEBIT(current->header);
+
+      STAT_ADD(visited, 1);
+      if (current_size < size)
+        continue;
+      if (best == NULL || current_size < GET_SIZEBIT(best->header))
+        best = current;
+      if (current_size == size || --limit == 0)
+        return best;
+    }
+  }
+
+  if (best == NULL)
+    return tree_fit(arena, size);
+  return best;
+}
+
+/*
+ * first fit algorithm for malloc
+ * size is the full chunk size that is needed
+ *
+ * searches the size class of size first because it may contain smaller
+ * chunks, every chunk of a bigger class is big enough so the head is taken
+ * big requests and requests that no list can serve use best fit in the tree
+ * the other placement policies of the lists are handed on
+ *
+ * Null if not found
+ */
+static FreeChunk *first_fit(Arena *arena, unsigned size) {
+
+  STAT_ADD(searches, 1);
+  if (size >= TREE_MIN)
+    return tree_fit(arena, size);
+
+  switch (arena->policy) {
+  case MM_NEXT_FIT:
+    return next_fit(arena, size);
+  case MM_GOOD_FIT:
+    return best_fit(arena, size, FIT_K);
+  case MM_BEST_FIT:
+    return best_fit(arena, size, UINT_MAX);
+  }
+
+  int cls = size_class(size);
+
+  for (FreeChunk *current = FREE_LISTS[cls]; current != NULL;
+       current = NEXT_CHUNK(current)) {
+    STAT_ADD(visited, 1);
+    if (GET_SIZEBIT(current->header) >= size)
+      return current;
+  }
+
+  for (cls++; cls < NUM_CLASSES; cls++) {
+    if (FREE_LISTS[cls] != NULL)
+      return FREE_LISTS[cls];
+  }
+
+  return tree_fit(arena, size);
+}
+#endif
+
+/*
+ * coalesces two neighbouring chunks of memory
+ * none of both may be in a free list, second is merged into first
+ */
+static inline void coalesc(FreeChunk *first, FreeChunk *second) {
+
+  unsigned new_size = GET_SIZEBIT(first->header) + GET_SIZEBIT(second->header);
+
+  STAT_ADD(coalesces, 1);
+  SET_SIZEBIT(first->header, new_size);
+  SET_FOOTER(first, first->header);
+}
+
+/*
+ * marks a not free chunk as free, coalesces it with free neighbours and
+ * inserts the resulting block into the free list of its size class
+ * a big free chunk at the end of the heap is trimmed
+ */
+static void free_chunk(Arena *arena, FreeChunk *chunk) {
+
+  SET_ISFREE(chunk->header);
+  SET_FOOTER(chunk, chunk->header);
+  SET_NEXT_PREVBIT(chunk);
+
+  // --- coalescing ---
+
+  // coalesc prev, the bottom boundary looks like a not free chunk
+  if (GET_PREVBIT(chunk->header) == 0) {
+    FreeChunk *prev = (FreeChunk *)JUMP_PREV_FROM_STRUCT(chunk);
+    remove_free(arena, prev);
+    coalesc(prev, chunk);
+    chunk = prev;
+  }
+
+  // coalesc next, END is never free
+  FreeChunk *next = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(chunk);
+  if (GET_FREEBIT(next->header) == 0) {
+    remove_free(arena, next);
+    coalesc(chunk, next);
+  }
+
+  insert_free(arena, chunk);
+
+#ifdef CHECKHEAP
+  check_chunk(arena, (Chunk *)chunk, __LINE__);
+#endif
+
+  if (GET_SIZEBIT(chunk->header) >= TRIM_THRESHOLD &&
+      JUMP_NEXT_FROM_STRUCT(chunk) == END)
+    heap_trim(arena, AUTO_TRIM_PAD);
+}
+
+#ifdef DEFER_COALESCE
+/*
+ * frees all chunks of the quick lists in one batch
+ * every chunk leaves its list before free_chunk, which may trim and check
+ * the heap
+ */
+static void consolidate(Arena *arena) {
+  for (int bin = 0; bin < QUICK_BINS; bin++) {
+    while (QUICK_LISTS[bin] != NULL) {
+      FreeChunk *chunk = QUICK_LISTS[bin];
+
+      QUICK_LISTS[bin] = NEXT_CHUNK(chunk);
+      arena->quick_count--;
+      free_chunk(arena, chunk);
+    }
+  }
+}
+#endif
+
+/*
+ * first_fit, with deferred coalescing the quick lists are coalesced and
+ * searched again before the heap has to grow
+ */
+static FreeChunk *find_fit(Arena *arena, unsigned size) {
+  FreeChunk *fit = first_fit(arena, size);
+
+#ifdef DEFER_COALESCE
+  if (fit == NULL && arena->quick_count > 0) {
+    consolidate(arena);
+    fit = first_fit(arena, size);
+  }
+#endif
+
+  return fit;
+}
+
+/*
+ * grows the heap by size bytes, the new space becomes a free chunk that is
+ * merged with a free last chunk. the chunk is not put into a free list
+ */
+static FreeChunk *extend_heap(Arena *arena, unsigned size) {
+  // a negative increment would shrink the heap
+  if (size > INT_MAX ||
+      mem_region_sbrk(arena->region, (int)size) == (void *)-1)
+    return NULL;
+  STAT_ADD(sbrks, 1);
+  STAT_ADD(sbrk_bytes, size);
+
+  // the new chunk starts at the old end guard, its prev_size stays
+  FreeChunk *chunk = (FreeChunk *)END;
+  SET_SIZEBIT(chunk->header, size);
+  SET_ISFREE(chunk->header);
+  SET_LASTCHUNK(chunk);
+  SET_FOOTER(chunk, chunk->header);
+
+  if (GET_PREVBIT(chunk->header) == 0) {
+    FreeChunk *prev = (FreeChunk *)JUMP_PREV_FROM_STRUCT(chunk);
+    remove_free(arena, prev);
+    coalesc(prev, chunk);
+    chunk = prev;
+  }
+  return chunk;
+}
+
+/* size of the last chunk if it is free, 0 otherwise */
+static inline unsigned tail_free(Arena *arena) {
+  if (GET_PREVBIT(END->header) != 0)
+    return 0;
+  return GET_SIZEBIT(JUMP_PREV_FROM_STRUCT(END)->header);
+}
+
+/*
+ * grows the heap for a chunk of size bytes, a free last chunk is only
+ * extended by the bytes it is missing. the heap grows by at least
+ * GROW_MIN, what is left over stays a free chunk when the caller splits.
+ * returns the free last chunk, not in a free list
+ */
+static FreeChunk *grow_heap(Arena *arena, unsigned size) {
+  unsigned missing = size - tail_free(arena);
+
+  if (missing < GROW_MIN)
+    missing = ALIGN(GROW_MIN);
+  return extend_heap(arena, missing);
+}
+
+/*
+ * allocates a chunk of the heap for a request of size bytes, never a slot
+ * if no free chunk is available for this -> ask for more memory from system
+ * if free chunk is available -> try to split the chunk and repair the freelist
+ */
+static void *heap_malloc_chunk(Arena *arena, size_t size) {
+
+  if (size > CHUNK_MAX_REQUEST)
+    return NULL;
+
+  unsigned calcedsize = request_size(size);
+
+#ifdef DEFER_COALESCE
+  if (calcedsize <= QUICK_MAX &&
+      QUICK_LISTS[calcedsize / ALIGNMENT] != NULL) {
+    FreeChunk *quick = QUICK_LISTS[calcedsize / ALIGNMENT];
+    QUICK_LISTS[calcedsize / ALIGNMENT] = NEXT_CHUNK(quick);
+    arena->quick_count--;
+    return &((Chunk *)quick)->payload;
+  }
+#endif
+
+  FreeChunk *fit = find_fit(arena, calcedsize);
+
+  if (fit != NULL) {
+    remove_free(arena, fit);
+  } else {
+    // no free chunks available
+    fit = grow_heap(arena, calcedsize);
+    if (fit == NULL)
+      return NULL;
+  }
+
+  unsigned oldsize = GET_SIZEBIT(fit->header);
+
+  if (oldsize >= (calcedsize + MIN_CHUNKSIZE)) {
+    // split
+
+    STAT_ADD(splits, 1);
+    SET_SIZEBIT(fit->header, calcedsize);
+    SET_NOTFREE(fit->header);
+
+    // the chunk after new_split keeps its prev bit, fit was free
+    FreeChunk *new_split = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(fit);
+
+    new_split->header = oldsize - calcedsize;
+    SET_ISFREE(new_split->header);
+    new_split->header |= PREVBIT_OF(fit->header);
+    SET_FOOTER(new_split, new_split->header);
+
+    insert_free(arena, new_split);
+
+  } else {
+    // dont split
+
+    SET_NOTFREE(fit->header);
+    SET_NEXT_PREVBIT(fit);
+  }
+
+#ifdef CHECKHEAP
+  check_chunk(arena, (Chunk *)fit, __LINE__);
+  check_full(arena, __LINE__);
+#endif
+
+  return (void *)&((Chunk *)fit)->payload;
+}
+
+/*
+ * heap_malloc - Allocate a block by incrementing the brk pointer.
+ *     Always allocate a block whose size is a multiple of the alignment.
+ *
+ * requests of at most SLAB_MAX bytes are slots, all others chunks
+ */
+static void *heap_malloc(Arena *arena, size_t size) {
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+#endif
+
+  if (size == 0)
+    return NULL;
+
+  if (size <= SLAB_MAX)
+    return slab_alloc(arena, size);
+
+  return heap_malloc_chunk(arena, size);
+}
+
+/*
+ * frees a chunk that is no slot with free_chunk, with deferred coalescing
+ * small chunks go to their quick list instead
+ */
+static void heap_free_chunk(Arena *arena, void *ptr) {
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+#endif
+
+  FreeChunk *chunk = (FreeChunk *)PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr);
+  if (GET_FREEBIT(chunk->header) == 0) {
+    printf("Trying to freeing a free chunk. Canceling\n");
+    return;
+  }
+
+#ifdef DEFER_COALESCE
+  unsigned size = GET_SIZEBIT(chunk->header);
+  if (size <= QUICK_MAX) {
+    SET_NEXT_CHUNK(chunk, QUICK_LISTS[size / ALIGNMENT]);
+    QUICK_LISTS[size / ALIGNMENT] = chunk;
+    if (++arena->quick_count >= QUICK_LIMIT)
+      consolidate(arena);
+    return;
+  }
+#endif
+
+  free_chunk(arena, chunk);
+
+#ifdef CHECKHEAP
+  check_full(arena, __LINE__);
+#endif
+}
+
+/*
+ * heap_free
+ *
+ * slots go back to their slab, chunks to heap_free_chunk
+ */
+static void heap_free(Arena *arena, void *ptr) {
+  if (ptr == NULL)
+    return;
+
+  if (IS_SLAB(ptr))
+    slab_free(arena, ptr);
+  else
+    heap_free_chunk(arena, ptr);
+}
+
+/*
+ * shrinks a not free chunk to size and turns the rest into a free chunk
+ * if the rest is big enough. the rest is coalesced with a free next chunk
+ */
+static void split_chunk(Arena *arena, Chunk *chunk, unsigned size) {
+
+  unsigned oldsize = GET_SIZEBIT(chunk->header);
+
+  if (oldsize < size + MIN_CHUNKSIZE)
+    return;
+
+  STAT_ADD(splits, 1);
+  SET_SIZEBIT(chunk->header, size);
+
+  FreeChunk *rest = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(chunk);
+  rest->header = oldsize - size;
+  SET_ISFREE(rest->header);
+  rest->header |= PREVBIT_OF(chunk->header);
+  SET_FOOTER(rest, rest->header);
+  SET_NEXT_PREVBIT(rest);
+
+  FreeChunk *next = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(rest);
+  if (GET_FREEBIT(next->header) == 0) {
+    remove_free(arena, next);
+    coalesc(rest, next);
+  }
+
+  insert_free(arena, rest);
+}
+
+/*
+ * heap_realloc - resizes the chunk in place whenever possible
+ *
+ * shrinking splits the tail off as a free chunk
+ * growing takes the free next chunk or extends the heap if the chunk
+ * (or the chunk and its free next chunk) is the last one before END
+ * only if none of these work the payload is copied to a new chunk
+ */
+static void *heap_realloc(Arena *arena, void *ptr, size_t size) {
+
+  if (ptr == NULL)
+    return heap_malloc(arena, size);
+
+  if (size == 0) {
+    heap_free(arena, ptr);
+    return NULL;
+  }
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+#endif
+
+  // slots keep their slab as long as the request fits
+  if (IS_SLAB(ptr)) {
+    unsigned slot_size = SLAB_OF(ptr)->slot_size;
+    if (size <= slot_size)
+      return ptr;
+
+    void *newptr = heap_malloc(arena, size);
+    if (newptr == NULL)
+      return NULL;
+    memcpy(newptr, ptr, slot_size);
+    slab_free(arena, ptr);
+    return newptr;
+  }
+
+  if (size > CHUNK_MAX_REQUEST)
+    return NULL;
+
+  Chunk *chunk = PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr);
+  unsigned oldsize = GET_SIZEBIT(chunk->header);
+  unsigned calcedsize = request_size(size);
+
+  // shrink in place
+  if (calcedsize <= oldsize) {
+    split_chunk(arena, chunk, calcedsize);
+
+#ifdef CHECKHEAP
+    check_chunk(arena, chunk, __LINE__);
+#endif
+
+    return ptr;
+  }
+
+  Chunk *next = JUMP_NEXT_FROM_STRUCT(chunk);
+  unsigned available = oldsize;
+  if (GET_FREEBIT(next->header) == 0)
+    available += GET_SIZEBIT(next->header);
+
+  // grow into the free next chunk
+  if (available >= calcedsize) {
+    remove_free(arena, (FreeChunk *)next);
+    STAT_ADD(coalesces, 1);
+    SET_SIZEBIT(chunk->header, available);
+    SET_NEXT_PREVBIT(chunk);
+    split_chunk(arena, chunk, calcedsize);
+
+#ifdef CHECKHEAP
+    check_chunk(arena, chunk, __LINE__);
+    check_full(arena, __LINE__);
+#endif
+
+    return ptr;
+  }
+
+  // extend the heap if nothing but free space follows the chunk
+  if (next == END || (available != oldsize &&
+                      JUMP_NEXT_FROM_STRUCT(next) == END)) {
+    // exactly what is missing, a rest at the end would be taken by other
+    // requests and the next realloc could not grow in place any more
+    unsigned missing = calcedsize - available;
+
+    void *p = mem_region_sbrk(arena->region, missing);
+    if (p == (void *)-1)
+      return NULL;
+    STAT_ADD(sbrks, 1);
+    STAT_ADD(sbrk_bytes, missing);
+
+    if (next != END)
+      remove_free(arena, (FreeChunk *)next);
+
+    SET_SIZEBIT(chunk->header, calcedsize);
+    SET_LASTCHUNK(chunk);
+
+#ifdef CHECKHEAP
+    check_chunk(arena, chunk, __LINE__);
+    check_full(arena, __LINE__);
+#endif
+
+    return ptr;
+  }
+
+  void *newptr = heap_malloc(arena, size);
+  if (newptr == NULL)
+    return NULL;
+  memcpy(newptr, ptr, PAYLOADSIZE_FROM_CHUNKSIZE(oldsize));
+  heap_free(arena, ptr);
+  return newptr;
+}
+
+/*
+ * first payload address at or after payload that is aligned to align and
+ * leaves room for a free chunk in front of it
+ */
+static inline char *align_payload(char *payload, unsigned align) {
+  char *aligned =
+      (char *)(((uintptr_t)payload + align - 1) & ~(uintptr_t)(align - 1));
+
+  if (aligned != payload && aligned - payload < MIN_CHUNKSIZE)
+    aligned += align;
+  return aligned;
+}
+
+/*
+ * allocates a chunk of size bytes (full chunk size) with a payload aligned
+ * to align, a power of two. the space in front of the payload is turned
+ * into a free chunk, the tail is split off like in heap_malloc
+ *
+ * a free chunk is only taken if it fits for every possible alignment,
+ * otherwise the heap grows by what the last chunk is missing (at least
+ * GROW_MIN like in grow_heap)
+ */
+static void *heap_alloc_aligned(Arena *arena, unsigned size, unsigned align) {
+  FreeChunk *fit = find_fit(arena, size + align + MIN_CHUNKSIZE);
+
+  if (fit != NULL) {
+    remove_free(arena, fit);
+  } else {
+    Chunk *last = END;
+    int missing = size - tail_free(arena);
+
+    if (GET_PREVBIT(END->header) == 0)
+      last = JUMP_PREV_FROM_STRUCT(END);
+    missing += align_payload(&last->payload, align) - &last->payload;
+
+    if (missing > 0) {
+      if (missing < GROW_MIN)
+        missing = ALIGN(GROW_MIN);
+      fit = extend_heap(arena, missing);
+      if (fit == NULL)
+        return NULL;
+    } else {
+      fit = (FreeChunk *)last;
+      remove_free(arena, fit);
+    }
+  }
+
+  Chunk *chunk = (Chunk *)fit;
+  char *payload = align_payload(&chunk->payload, align);
+
+  if (payload != &chunk->payload) {
+    unsigned fitsize = GET_SIZEBIT(fit->header);
+    unsigned gap = payload - &chunk->payload;
+
+    STAT_ADD(splits, 1);
+    // the prev chunk of a free chunk is never free
+    fit->header = gap | 0b10;
+    SET_FOOTER(fit, fit->header);
+    insert_free(arena, fit);
+
+    chunk = PAYLOAD_TO_CHUNKSTRUCT_PTR(payload);
+    chunk->header = fitsize - gap;
+  }
+
+  SET_NOTFREE(chunk->header);
+  SET_NEXT_PREVBIT(chunk);
+  split_chunk(arena, chunk, size);
+
+  return payload;
+}
+
+/*
+ * heap_memalign - allocates size bytes with a payload aligned to align, a
+ * power of two bigger than ALIGNMENT. mm_memalign maps requests with
+ * size + align >= MMAP_THRESHOLD, so nothing here can overflow
+ */
+static void *heap_memalign(Arena *arena, size_t align, size_t size) {
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+#endif
+
+  void *ptr = heap_alloc_aligned(arena, request_size(size), align);
+
+#ifdef CHECKHEAP
+  if (ptr != NULL)
+    check_chunk(arena, PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr), __LINE__);
+  check_full(arena, __LINE__);
+#endif
+
+  return ptr;
+}
+
+/*
+ * heap_malloc_batch - allocates n blocks of size bytes into out, returns
+ * how many it got. the chunks are carved back to back from one free chunk
+ * that fits all of them, with one search and one split of the rest.
+ * otherwise every free chunk first_fit finds for one block is carved into
+ * as many as it holds, what is left comes from one growth of the heap.
+ * slots come from their slab one after the other
+ */
+static size_t heap_malloc_batch(Arena *arena, size_t size, size_t n,
+                                void **out) {
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+#endif
+
+  size_t done = 0;
+
+  if (size == 0 || size > CHUNK_MAX_REQUEST)
+    return 0;
+
+  if (size <= SLAB_MAX) {
+    while (done < n && (out[done] = slab_alloc(arena, size)) != NULL)
+      done++;
+    return done;
+  }
+
+  unsigned chunksize = request_size(size);
+  // a run has to fit into the heap and into one mem_sbrk increment
+  size_t most = mem_max_heapsize() < INT_MAX ? mem_max_heapsize() : INT_MAX;
+  most /= chunksize;
+
+  while (n - done > 1 && most > 1) {
+    unsigned total = chunksize * (n - done < most ? n - done : most);
+    FreeChunk *fit = find_fit(arena, total);
+
+    if (fit == NULL)
+      fit = first_fit(arena, chunksize);
+    if (fit != NULL)
+      remove_free(arena, fit);
+    else if ((fit = grow_heap(arena, total)) == NULL)
+      break;
+
+    Chunk *chunk = (Chunk *)fit;
+    unsigned count = GET_SIZEBIT(chunk->header) / chunksize;
+
+    if (count == 0) {
+      insert_free(arena, fit);
+      break;
+    }
+    if (count > n - done)
+      count = n - done;
+    total = chunksize * count;
+
+    SET_NOTFREE(chunk->header);
+    SET_NEXT_PREVBIT(chunk);
+    split_chunk(arena, chunk, total);
+
+    // the last chunk keeps what was too small to split off, the first
+    // keeps the prev bit, all others follow a not free chunk
+    unsigned slack = GET_SIZEBIT(chunk->header) - total;
+
+    STAT_ADD(splits, count - 1);
+    SET_SIZEBIT(chunk->header, chunksize);
+    out[done++] = &chunk->payload;
+    while (--count > 0) {
+      chunk = (Chunk *)((char *)chunk + chunksize);
+      chunk->header = chunksize | 0b10;
+      SET_NOTFREE(chunk->header);
+      out[done++] = &chunk->payload;
+    }
+    SET_SIZEBIT(chunk->header, chunksize + slack);
+  }
+
+  while (done < n && (out[done] = heap_malloc(arena, size)) != NULL)
+    done++;
+
+#ifdef CHECKHEAP
+  for (size_t i = 0; i < done; i++)
+    check_chunk(arena, PAYLOAD_TO_CHUNKSTRUCT_PTR(out[i]), __LINE__);
+  check_full(arena, __LINE__);
+#endif
+
+  return done;
+}
+
+/*
+ * heap_free_batch - frees n payloads of the heap, sorted by address and
+ * not NULL. neighbouring chunks are merged into one free chunk first, so
+ * every run of them is coalesced and put into a free list only once.
+ * a chunk without a neighbour in the batch goes through heap_free
+ */
+static void heap_free_batch(Arena *arena, void **ptrs, size_t n) {
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+#endif
+
+  size_t i = 0;
+
+  while (i < n) {
+    if (IS_SLAB(ptrs[i])) {
+      slab_free(arena, ptrs[i++]);
+      continue;
+    }
+
+    Chunk *first = PAYLOAD_TO_CHUNKSTRUCT_PTR(ptrs[i]);
+    Chunk *last = first;
+    size_t start = i++;
+
+    while (i < n && !IS_SLAB(ptrs[i]) &&
+           PAYLOAD_TO_CHUNKSTRUCT_PTR(ptrs[i]) == JUMP_NEXT_FROM_STRUCT(last) &&
+           GET_FREEBIT(JUMP_NEXT_FROM_STRUCT(last)->header) != 0) {
+      last = JUMP_NEXT_FROM_STRUCT(last);
+      i++;
+    }
+
+    if (last == first || GET_FREEBIT(first->header) == 0) {
+      for (; start < i; start++)
+        heap_free(arena, ptrs[start]);
+      continue;
+    }
+
+    unsigned size = (char *)JUMP_NEXT_FROM_STRUCT(last) - (char *)first;
+    STAT_ADD(coalesces, i - start - 1);
+    SET_SIZEBIT(first->header, size);
+    free_chunk(arena, (FreeChunk *)first);
+  }
+
+#ifdef CHECKHEAP
+  check_full(arena, __LINE__);
+#endif
+}
+
+/* orders payload pointers by address for mm_free_batch */
+static int compare_ptrs(const void *a, const void *b) {
+  void *const *x = a;
+  void *const *y = b;
+
+  return ((uintptr_t)*x > (uintptr_t)*y) - ((uintptr_t)*x < (uintptr_t)*y);
+}
+
+/*
+ * ---------------------------------
+ * slabs for small requests
+ *
+ * a slab is a not free chunk with a page aligned payload of SLAB_SIZE
+ * bytes. the page starts with the Slab struct, the rest is cut in slots
+ * of one slab class. slots have no header, their size is found in the
+ * Slab struct at the start of their page, and the bit of the page in
+ * SLAB_MAP tells heap_free and heap_realloc that a pointer is a slot.
+ *
+ * slots that were never used are cut from the page in address order,
+ * freed slots are reused first. slabs with free slots are in the list of
+ * their class, an empty slab goes back to the heap unless it is the only
+ * one with free slots in its class.
+ * ---------------------------------
+ */
+
+/* takes a slab out of the list of its class */
+static inline void slab_unlink(Arena *arena, Slab *slab) {
+  if (slab->prev_slab != NULL)
+    slab->prev_slab->next_slab = slab->next_slab;
+  else
+    SLABS[slab->slot_size / ALIGNMENT - 1] = slab->next_slab;
+
+  if (slab->next_slab != NULL)
+    slab->next_slab->prev_slab = slab->prev_slab;
+}
+
+/* puts a slab at the head of the list of its class */
+static inline void slab_link(Arena *arena, Slab *slab) {
+  Slab **head = &SLABS[slab->slot_size / ALIGNMENT - 1];
+
+  slab->prev_slab = NULL;
+  slab->next_slab = *head;
+  if (*head != NULL)
+    (*head)->prev_slab = slab;
+  *head = slab;
+}
+
+/* gives an empty slab back to the heap */
+static void slab_drop(Arena *arena, Slab *slab) {
+  slab_unlink(arena, slab);
+  __atomic_fetch_and(&SLAB_MAP[SLAB_PAGE(slab) / 8],
+                     ~(1 << (SLAB_PAGE(slab) % 8)), __ATOMIC_RELAXED);
+  arena->slab_count--;
+  heap_free(arena, slab);
+}
+
+/* gets a new empty slab for slots of slot_size bytes from the heap */
+static Slab *new_slab(Arena *arena, unsigned slot_size) {
+  Slab *slab = heap_alloc_aligned(arena, CALC_CHUNK_SIZE(SLAB_SIZE), SLAB_SIZE);
+  if (slab == NULL)
+    return NULL;
+
+  slab->free_slots = NULL;
+  slab->slot_size = slot_size;
+  slab->used = 0;
+  slab->carved = 0;
+  slab->capacity = (SLAB_SIZE - SLAB_HEADER) / slot_size;
+  slab_link(arena, slab);
+  arena->slab_count++;
+
+  __atomic_fetch_or(&SLAB_MAP[SLAB_PAGE(slab) / 8], 1 << (SLAB_PAGE(slab) % 8),
+                    __ATOMIC_RELAXED);
+  return slab;
+}
+
+/*
+ * gives a slot of the first slab with free slots in the class of size
+ * full slabs leave the list until a slot is freed
+ */
+static void *slab_alloc(Arena *arena, size_t size) {
+  Slab *slab = SLABS[(size - 1) / ALIGNMENT];
+
+  if (slab == NULL) {
+    if (arena->slab_count == 0 && END != START &&
+        (char *)END - (char *)START < SLAB_MIN_HEAP)
+      return heap_malloc_chunk(arena, size);
+    slab = new_slab(arena, ALIGN(size));
+    if (slab == NULL)
+      return NULL;
+  }
+
+  void *slot = slab->free_slots;
+  if (slot != NULL)
+    slab->free_slots = *(void **)slot;
+  else
+    slot = (char *)slab + SLAB_HEADER + slab->carved++ * slab->slot_size;
+
+  if (++slab->used == slab->capacity)
+    slab_unlink(arena, slab);
+
+#ifdef CHECKHEAP
+  check_chunk(arena, PAYLOAD_TO_CHUNKSTRUCT_PTR(slab), __LINE__);
+  check_full(arena, __LINE__);
+#endif
+
+  return slot;
+}
+
+/* gives a slot back to its slab */
+static void slab_free(Arena *arena, void *ptr) {
+  Slab *slab = SLAB_OF(ptr);
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+  check_chunk(arena, PAYLOAD_TO_CHUNKSTRUCT_PTR(slab), __LINE__);
+#endif
+
+  *(void **)ptr = slab->free_slots;
+  slab->free_slots = ptr;
+
+  if (slab->used-- == slab->capacity) {
+    slab_link(arena, slab);
+  } else if (slab->used == 0 &&
+             (slab->prev_slab != NULL || slab->next_slab != NULL ||
+              JUMP_NEXT_FROM_STRUCT(PAYLOAD_TO_CHUNKSTRUCT_PTR(slab)) == END)) {
+    // the last empty slab of a class is kept unless it is the last chunk
+    slab_drop(arena, slab);
+  }
+
+#ifdef CHECKHEAP
+  check_full(arena, __LINE__);
+#endif
+}
+
+/*
+ * gives the empty slab slab_free keeps for every class back to the heap,
+ * it would pin the end of the heap for mm_trim
+ */
+static void slab_release(Arena *arena) {
+  for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+    Slab *slab = SLABS[cls];
+
+    while (slab != NULL) {
+      Slab *next = slab->next_slab;
+      if (slab->used == 0)
+        slab_drop(arena, slab);
+      slab = next;
+    }
+  }
+}
+
+/*
+ * heap_reserve - grows the heap in one step until the free last chunk has
+ * at least bytes bytes, later requests are served from it without sbrk.
+ * the trims of free keep bytes free bytes from now on (top_pad)
+ */
+static int heap_reserve(Arena *arena, size_t bytes) {
+  unsigned have = tail_free(arena);
+
+  if (bytes <= have) {
+    arena->top_pad = bytes;
+    return 0;
+  }
+  // mem_region_sbrk takes an int
+  if (bytes - have > INT_MAX - ALIGNMENT)
+    return -1;
+
+  unsigned missing = ALIGN(bytes - have);
+  if (have == 0 && missing < MIN_CHUNKSIZE)
+    missing = MIN_CHUNKSIZE;
+
+  FreeChunk *chunk = extend_heap(arena, missing);
+  if (chunk == NULL)
+    return -1;
+  insert_free(arena, chunk);
+  arena->top_pad = bytes;
+
+#ifdef CHECKHEAP
+  check_full(arena, __LINE__);
+#endif
+
+  return 0;
+}
+
+/*
+ * heap_trim - gives the free last chunk back to memlib, only pad bytes of
+ * it are kept. returns 1 if the heap shrank, 0 otherwise
+ */
+static int heap_trim(Arena *arena, size_t pad) {
+#ifdef DEFER_COALESCE
+  // chunks of the quick lists look not free and would hide a free end
+  if (arena->quick_count > 0)
+    consolidate(arena);
+#endif
+
+  unsigned have = tail_free(arena);
+  size_t keep = ALIGN(pad);
+
+  if (keep != 0 && keep < MIN_CHUNKSIZE)
+    keep = MIN_CHUNKSIZE;
+  if (have <= keep)
+    return 0;
+
+  FreeChunk *last = (FreeChunk *)JUMP_PREV_FROM_STRUCT(END);
+  remove_free(arena, last);
+
+  if (keep == 0) {
+    // the chunk before a free chunk is not free
+    last->header = GET_PREVBIT(last->header);
+    SET_NOTFREE(last->header);
+    END = (Chunk *)last;
+  } else {
+    SET_SIZEBIT(last->header, keep);
+    SET_FOOTER(last, last->header);
+    SET_LASTCHUNK(last);
+    insert_free(arena, last);
+  }
+
+  // mem_region_sbrk takes an int, a free tail past 2 GB goes in steps
+  size_t give = have - keep;
+  while (give > 0) {
+    int step = give > INT_MAX ? INT_MAX : (int)give;
+    mem_region_sbrk(arena->region, -step);
+    give -= step;
+  }
+  STAT_ADD(trims, 1);
+  STAT_ADD(trim_bytes, have - keep);
+
+#ifdef CHECKHEAP
+  check_full(arena, __LINE__);
+#endif
+
+  return 1;
+}
+
+/*
+ * moves the handle block after the free chunk hole down to the address of
+ * hole, the free chunk ends up behind the block and is coalesced with a
+ * free next chunk. returns the block at its new place
+ */
+static Chunk *slide_block(Arena *arena, FreeChunk *hole, Chunk *block) {
+  unsigned hole_size = GET_SIZEBIT(hole->header);
+  unsigned size = GET_SIZEBIT(block->header);
+  // the chunk before a free chunk is not free
+  unsigned header = block->header | 0b10;
+  Chunk *moved = (Chunk *)hole;
+
+  remove_free(arena, hole);
+  // a bigger block overwrites its own header, the payload reaches into
+  // the prev_size of the free chunk behind it
+  memmove(&moved->payload, &block->payload, PAYLOADSIZE_FROM_CHUNKSIZE(size));
+  moved->header = header;
+
+  FreeChunk *rest = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(moved);
+  rest->header = hole_size | 0b10;
+  SET_FOOTER(rest, rest->header);
+  SET_NEXT_PREVBIT(rest);
+
+  FreeChunk *next = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(rest);
+  if (GET_FREEBIT(next->header) == 0) {
+    remove_free(arena, next);
+    coalesc(rest, next);
+  }
+  insert_free(arena, rest);
+
+  (*(Handle **)&moved->payload)->ptr = &moved->payload + HANDLE_PAD;
+
+#ifdef CHECKHEAP
+  check_chunk(arena, moved, __LINE__);
+  check_chunk(arena, (Chunk *)rest, __LINE__);
+#endif
+
+  return moved;
+}
+
+/*
+ * heap_compact - slides unlocked handle blocks down into the free chunk in
+ * front of them, so the free space moves up to the end of the heap.
+ * starts behind compact_cursor and stops when budget bytes were moved (0
+ * for no limit) or at END, where the free last chunk is trimmed and the
+ * next call starts at START again. chunks that are not handle blocks and
+ * locked ones stay where they are. returns the bytes moved
+ */
+static size_t heap_compact(Arena *arena, size_t budget) {
+
+#ifdef CHECKHEAP
+  check_op(arena, __LINE__);
+#endif
+
+  size_t moved = 0;
+  Chunk *current = arena->compact_cursor != NULL
+                       ? JUMP_NEXT_FROM_STRUCT(arena->compact_cursor)
+                       : START;
+
+  while (current != END) {
+    Chunk *next = JUMP_NEXT_FROM_STRUCT(current);
+
+    // END is neither free nor a handle block
+    if (GET_FREEBIT(current->header) != 0 ||
+        GET_HANDLEBIT(next->header) == 0 ||
+        (*(Handle **)&next->payload)->locks != 0) {
+      current = next;
+      continue;
+    }
+
+    moved += GET_SIZEBIT(next->header);
+    current = slide_block(arena, (FreeChunk *)current, next);
+    if (budget != 0 && moved >= budget) {
+      arena->compact_cursor = current;
+      return moved;
+    }
+    current = JUMP_NEXT_FROM_STRUCT(current);
+  }
+
+  arena->compact_cursor = NULL;
+  heap_trim(arena, AUTO_TRIM_PAD);
+
+#ifdef CHECKHEAP
+  check_full(arena, __LINE__);
+#endif
+
+  return moved;
+}
+
+/*
+ * ---------------------------------
+ * mapped chunks
+ *
+ * a request of at least MMAP_THRESHOLD bytes gets a mapping of its own
+ * from mem_map. the mapping starts with its length as a size_t, so it can
+ * be bigger than any chunk of the heap, followed by a Chunk struct of size
+ * 0 that looks like a not free chunk and the ALIGNMENT aligned payload.
+ * for mm_memalign the length is moved behind a pad of less than a page,
+ * the size bits of the Chunk struct hold the pad (MAP_PAD).
+ * mapped chunks are outside of every region, so they are not limited by
+ * MAX_HEAP, never fragment a heap, go back to the system on free and
+ * need no lock.
+ * ---------------------------------
+ */
+
+/* bytes in front of the payload of a mapped chunk */
+#define MAP_OFFSET ALIGN(sizeof(size_t) + 2 * sizeof(unsigned))
+
+/* the length of the mapping a mapped chunk starts with */
+#define MAP_LENGTH(ptr) (*(size_t *)((char *)(ptr) - MAP_OFFSET))
+
+/* bytes of the mapping in front of the length, 0 unless aligned */
+#define MAP_PAD(ptr) GET_SIZEBIT(PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr)->header)
+
+/* start of the mapping of a mapped chunk */
+#define MAP_BASE(ptr) ((char *)(ptr) - MAP_OFFSET - MAP_PAD(ptr))
+
+/* length of the mapping for a payload of size bytes, 0 if too big */
+static inline size_t map_length(size_t size) {
+  size_t page = mem_pagesize();
+
+  if (size > SIZE_MAX - MAP_OFFSET - page)
+    return 0;
+  return (size + MAP_OFFSET + page - 1) & ~(page - 1);
+}
+
+/*
+ * maps a chunk with a payload of size bytes aligned to align (a power of
+ * two, 0 for ALIGNMENT). an aligned chunk is mapped align bytes bigger,
+ * the whole pages in front of and behind it are unmapped again
+ */
+static void *map_alloc(size_t size, size_t align) {
+  size_t extra = align > ALIGNMENT ? align : 0;
+  if (size > SIZE_MAX - extra)
+    return NULL;
+
+  size_t len = map_length(size + extra);
+  if (len == 0)
+    return NULL;
+
+  char *map = mem_map(len);
+  if (map == NULL)
+    return NULL;
+
+  char *payload = map + MAP_OFFSET;
+  size_t pad = 0;
+
+  if (extra != 0) {
+    payload = (char *)(((uintptr_t)payload + align - 1) &
+                       ~(uintptr_t)(align - 1));
+    pad = payload - MAP_OFFSET - map;
+
+    size_t lead = pad & ~(mem_pagesize() - 1);
+    if (lead != 0)
+      mem_unmap(map, lead);
+    map += lead;
+    len -= lead;
+    pad -= lead;
+
+    size_t keep = map_length(size + pad);
+    if (keep < len)
+      mem_unmap(map + keep, len - keep);
+    len = keep;
+  }
+
+  Chunk *chunk = PAYLOAD_TO_CHUNKSTRUCT_PTR(payload);
+  chunk->header = pad | 0b10;
+  SET_NOTFREE(chunk->header);
+  MAP_LENGTH(payload) = len;
+  STAT_ADD(maps, 1);
+  STAT_ADD(map_bytes, len);
+  return payload;
+}
+
+static void map_free(void *ptr) { mem_unmap(MAP_BASE(ptr), MAP_LENGTH(ptr)); }
+
+/*
+ * resizes the mapping of a mapped chunk, it may move
+ * below MMAP_THRESHOLD the payload moves to a chunk of the heap
+ */
+static void *map_realloc(void *ptr, size_t size) {
+  size_t oldlen = MAP_LENGTH(ptr);
+  size_t pad = MAP_PAD(ptr);
+
+  if (size < MMAP_THRESHOLD) {
+    void *newptr = size == 0 ? NULL : mm_malloc(size);
+    if (newptr != NULL)
+      memcpy(newptr, ptr, size);
+    if (newptr != NULL || size == 0)
+      map_free(ptr);
+    return newptr;
+  }
+
+  // the pad stays, the payload keeps its offset from the page
+  size_t len = size > SIZE_MAX - pad ? 0 : map_length(size + pad);
+  if (len == 0)
+    return NULL;
+  if (len == oldlen)
+    return ptr;
+
+  char *map = mem_remap(MAP_BASE(ptr), oldlen, len);
+  if (map == NULL)
+    return NULL;
+
+  MAP_LENGTH(map + pad + MAP_OFFSET) = len;
+  STAT_ADD(maps, 1);
+  STAT_ADD(map_bytes, len);
+  return map + pad + MAP_OFFSET;
+}
+
+/*
+ * moves a chunk or slot of the heap that grows to MMAP_THRESHOLD or more
+ * to a mapping of its own, the heap can neither extend in place nor
+ * hold a copy of it. the arena has to be locked
+ */
+static void *realloc_to_map(Arena *arena, void *ptr, size_t size) {
+  size_t oldsize =
+      IS_SLAB(ptr) ? SLAB_OF(ptr)->slot_size
+                   : PAYLOADSIZE_FROM_CHUNKSIZE(
+                         GET_SIZEBIT(PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr)->header));
+
+  void *newptr = map_alloc(size, 0);
+  if (newptr == NULL)
+    return NULL;
+  memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+  heap_free(arena, ptr);
+  return newptr;
+}
+
+/* the arena a payload pointer belongs to */
+static inline Arena *arena_of(void *ptr) {
+#ifdef THREADS
+  return &ARENAS[mem_region_of(ptr)];
+#else
+  return &ARENAS[0];
+#endif
+}
+
+#if defined(CHECKHEAP) || defined(STATS)
+/*
+ * payload bytes a block holds, the payload of a slot, chunk or mapping,
+ * mapped tells if it is a mapped chunk
+ */
+static size_t block_holds(void *ptr, int mapped) {
+  if (mapped)
+    return MAP_LENGTH(ptr) - MAP_OFFSET - MAP_PAD(ptr);
+
+  Arena *arena = arena_of(ptr);
+
+  if (IS_SLAB(ptr))
+    return SLAB_OF(ptr)->slot_size;
+  return PAYLOADSIZE_FROM_CHUNKSIZE(
+      GET_SIZEBIT(PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr)->header));
+}
+#endif
+
+#ifdef STATS
+/*
+ * counts a block in field[class] of what it holds (block_holds), mallocs,
+ * reallocs and frees all measure the block this way. mapped chunks are
+ * in no memlib region, NULL (a failed request) is not counted
+ */
+#define STAT_BLOCK(field, ptr)                                                 \
+  do {                                                                         \
+    void *p_ = (ptr);                                                          \
+    if (p_ != NULL)                                                            \
+      STAT_ADD(field[stat_class(block_holds(p_, mem_region_of(p_) < 0))], 1); \
+  } while (0)
+#else
+#define STAT_BLOCK(field, ptr) ((void)0)
+#endif
+
+#ifdef THREADS
+/*
+ * ---------------------------------
+ * thread safe build (compile with -DTHREADS)
+ *
+ * every arena is protected by its own lock. a thread is bound to an
+ * arena round robin when it allocates the first time and moves on to
+ * the next free arena when its arena is contended. mm_free and
+ * mm_realloc find the arena of a chunk from its address (memlib region)
+ * and lock that one, no matter which thread calls.
+ *
+ * every thread keeps a cache of chunks and slab slots it freed, one
+ * singly linked list (through next_chunk) per payload size up to
+ * TCACHE_MAX with at most TCACHE_COUNT chunks each. cached chunks stay
+ * marked as not free, so they are never coalesced. only a cache miss or a full cache list
+ * takes a lock, a full list gives half of its chunks back at once.
+ *
+ * a chunk freed by a thread that is bound to another arena is pushed
+ * onto the remote_frees stack of its arena with compare and swap. the
+ * thread that locks the arena for its next allocation takes the whole
+ * stack at once and frees the chunks in one batch. only whole stacks
+ * are taken, so there is no ABA problem.
+ * ---------------------------------
+ */
+
+#ifndef TCACHE_COUNT
+#define TCACHE_COUNT 32
+#endif
+
+#ifndef REMOTE_FREE
+#define REMOTE_FREE 1
+#endif
+#define TCACHE_MAX 512
+#define TCACHE_BINS (TCACHE_MAX / ALIGNMENT + 1)
+
+// bin of a chunk or slot that holds cap payload bytes. slots hold a
+// multiple of ALIGNMENT, chunks ALIGNMENT - sizeof(unsigned) bytes more,
+// so bins above SLAB_MAX are keyed by the chunk size
+#define TCACHE_BIN(cap)                                                        \
+  ((cap) <= SLAB_MAX ? (cap) / ALIGNMENT                                       \
+                     : ((cap) + sizeof(unsigned)) / ALIGNMENT)
+
+typedef struct ThreadCache ThreadCache;
+struct ThreadCache {
+  unsigned epoch; // HEAP_EPOCH the cached chunks belong to
+  unsigned count[TCACHE_BINS];
+  FreeChunk *chunks[TCACHE_BINS];
+  Arena *arena; // arena this thread allocates from
+};
+
+// bumped by every mm_init, caches of an older heap are dropped
+static unsigned HEAP_EPOCH;
+
+// next arena for round robin binding
+static unsigned NEXT_ARENA;
+
+static pthread_once_t ARENA_ONCE = PTHREAD_ONCE_INIT;
+
+static __thread ThreadCache TCACHE;
+
+// gives the cache back to the heap when its thread exits
+static pthread_key_t TCACHE_KEY;
+static pthread_once_t TCACHE_ONCE = PTHREAD_ONCE_INIT;
+
+/* locks an arena and initializes its heap on first use */
+static inline void lock_arena(Arena *arena) {
+  pthread_mutex_lock(&arena->lock);
+  if (START == NULL)
+    heap_init(arena);
+}
+
+static inline int trylock_arena(Arena *arena) {
+  if (pthread_mutex_trylock(&arena->lock) != 0)
+    return 0;
+  if (START == NULL)
+    heap_init(arena);
+  return 1;
+}
+
+static inline void unlock_arena(Arena *arena) {
+  pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * gives count chunks of one cache list back to their arenas
+ * locks every arena only once as long as the chunks come from the same
+ */
+static void tcache_flush(ThreadCache *cache, int bin, unsigned count) {
+  Arena *locked = NULL;
+
+  while (count-- > 0 && cache->chunks[bin] != NULL) {
+    FreeChunk *chunk = cache->chunks[bin];
+    void *ptr = &((Chunk *)chunk)->payload;
+    Arena *arena = arena_of(ptr);
+
+    if (arena != locked) {
+      if (locked != NULL)
+        unlock_arena(locked);
+      lock_arena(arena);
+      locked = arena;
+    }
+
+    cache->chunks[bin] = NEXT_CHUNK(chunk);
+    cache->count[bin]--;
+    heap_free(arena, ptr);
+  }
+
+  if (locked != NULL)
+    unlock_arena(locked);
+}
+
+/* thread exit destructor */
+static void tcache_release(void *arg) {
+  ThreadCache *cache = arg;
+
+  if (cache->epoch == __atomic_load_n(&HEAP_EPOCH, __ATOMIC_ACQUIRE)) {
+    for (int bin = 0; bin < TCACHE_BINS; bin++)
+      tcache_flush(cache, bin, cache->count[bin]);
+  }
+}
+
+static void tcache_key_init(void) {
+  pthread_key_create(&TCACHE_KEY, tcache_release);
+}
+
+/* the cache of the calling thread, emptied if the heap was reset */
+static inline ThreadCache *get_tcache(void) {
+  ThreadCache *cache = &TCACHE;
+  unsigned epoch = __atomic_load_n(&HEAP_EPOCH, __ATOMIC_ACQUIRE);
+
+  if (cache->epoch != epoch) {
+    if (cache->epoch == 0) {
+      pthread_once(&TCACHE_ONCE, tcache_key_init);
+      pthread_setspecific(TCACHE_KEY, cache);
+    }
+    memset(cache->count, 0, sizeof(cache->count));
+    memset(cache->chunks, 0, sizeof(cache->chunks));
+    if (cache->arena == NULL) {
+      unsigned next = __atomic_fetch_add(&NEXT_ARENA, 1, __ATOMIC_RELAXED);
+      cache->arena = &ARENAS[next % NUM_ARENAS];
+    }
+    cache->epoch = epoch;
+  }
+  return cache;
+}
+
+/* pushes a chunk onto the remote free stack of its arena, lock free */
+static inline void push_remote_free(Arena *arena, FreeChunk *chunk) {
+  FreeChunk *head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+
+  do {
+    SET_NEXT_CHUNK(chunk, head);
+  } while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, chunk, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* frees all chunks of the remote free stack, the arena is locked */
+static void drain_remote_frees(Arena *arena) {
+  if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) == NULL)
+    return;
+
+  FreeChunk *chunk =
+      __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+
+  while (chunk != NULL) {
+    FreeChunk *next = NEXT_CHUNK(chunk);
+    heap_free(arena, &((Chunk *)chunk)->payload);
+    chunk = next;
+  }
+}
+
+/*
+ * locks the arena of the calling thread
+ * if it is contended the thread moves to the first arena that is not
+ * chunks other threads freed into the arena are freed first
+ */
+static Arena *lock_thread_arena(ThreadCache *cache) {
+  Arena *arena = cache->arena;
+
+  if (!trylock_arena(arena)) {
+    int index = arena - ARENAS;
+    int i;
+
+    for (i = 1; i < NUM_ARENAS; i++) {
+      Arena *next = &ARENAS[(index + i) % NUM_ARENAS];
+      if (trylock_arena(next)) {
+        cache->arena = arena = next;
+        break;
+      }
+    }
+    if (i == NUM_ARENAS)
+      lock_arena(arena);
+  }
+
+  drain_remote_frees(arena);
+  return arena;
+}
+
+/* every arena gets its lock and its own memlib region once */
+static void arenas_init(void) {
+  for (int i = 0; i < NUM_ARENAS; i++) {
+    pthread_mutex_init(&ARENAS[i].lock, NULL);
+    ARENAS[i].region = i;
+  }
+}
+
+/*
+ * resets all arenas, only arena 0 gets a heap right away,
+ * the others get one when a thread uses them
+ */
+int mm_init(void) {
+  pthread_once(&ARENA_ONCE, arenas_init);
+#ifdef COMPACT_LINKS
+  LINK_BASE = (char *)mem_heap_lo() - sizeof(unsigned);
+  if (!LINKS_FIT())
+    return -1;
+#endif
+#ifdef STATS
+  reset_counters();
+#endif
+  for (int i = 0; i < NUM_ARENAS; i++) {
+    Arena *arena = &ARENAS[i];
+    START = NULL;
+    arena->remote_frees = NULL;
+  }
+  __atomic_add_fetch(&HEAP_EPOCH, 1, __ATOMIC_RELEASE);
+  return heap_init(&ARENAS[0]);
+}
+
+void *mm_malloc(size_t size) {
+  if (size >= MMAP_THRESHOLD) {
+    void *ptr = map_alloc(size, 0);
+    STAT_BLOCK(mallocs, ptr);
+    return ptr;
+  }
+
+  ThreadCache *cache = get_tcache();
+
+  // payload bytes a slot or chunk for size holds
+  size_t cap = size <= SLAB_MAX
+                   ? ALIGN(size)
+                   : PAYLOADSIZE_FROM_CHUNKSIZE(CALC_CHUNK_SIZE(size));
+
+  if (TCACHE_COUNT > 0 && size != 0 && cap <= TCACHE_MAX) {
+    int bin = TCACHE_BIN(cap);
+    FreeChunk *chunk = cache->chunks[bin];
+
+    if (chunk != NULL) {
+      cache->chunks[bin] = NEXT_CHUNK(chunk);
+      cache->count[bin]--;
+      STAT_BLOCK(mallocs, &((Chunk *)chunk)->payload);
+      return &((Chunk *)chunk)->payload;
+    }
+  }
+
+  Arena *arena = lock_thread_arena(cache);
+  void *ptr = heap_malloc(arena, size);
+  unlock_arena(arena);
+  STAT_BLOCK(mallocs, ptr);
+  return ptr;
+}
+
+void mm_free(void *ptr) {
+  if (ptr == NULL)
+    return;
+
+  // mapped chunks are in no region
+  int region = mem_region_of(ptr);
+  STAT_BLOCK(frees, ptr);
+  if (region < 0) {
+    map_free(ptr);
+    return;
+  }
+
+  Chunk *chunk = PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr);
+  ThreadCache *cache = get_tcache();
+  Arena *arena = &ARENAS[region];
+
+  if (REMOTE_FREE && arena != cache->arena) {
+    push_remote_free(arena, (FreeChunk *)chunk);
+    return;
+  }
+
+  // payload bytes the chunk or slot can hold
+  unsigned size = IS_SLAB(ptr) ? SLAB_OF(ptr)->slot_size
+                               : PAYLOADSIZE_FROM_CHUNKSIZE(
+                                     GET_SIZEBIT(chunk->header));
+
+  if (TCACHE_COUNT > 0 && size <= TCACHE_MAX) {
+    int bin = TCACHE_BIN(size);
+
+    if (cache->count[bin] >= TCACHE_COUNT)
+      tcache_flush(cache, bin, TCACHE_COUNT / 2);
+
+    SET_NEXT_CHUNK((FreeChunk *)chunk, cache->chunks[bin]);
+    cache->chunks[bin] = (FreeChunk *)chunk;
+    cache->count[bin]++;
+    return;
+  }
+
+  lock_arena(arena);
+  heap_free(arena, ptr);
+  unlock_arena(arena);
+}
+
+void *mm_realloc(void *ptr, size_t size) {
+  if (ptr == NULL)
+    return mm_malloc(size);
+
+  // realloc to 0 bytes is a free
+  if (size == 0)
+    STAT_BLOCK(frees, ptr);
+  int region = mem_region_of(ptr);
+  if (region < 0) {
+    void *newptr = map_realloc(ptr, size);
+    STAT_BLOCK(reallocs, newptr);
+    return newptr;
+  }
+
+  Arena *arena = &ARENAS[region];
+  lock_arena(arena);
+  void *newptr = size >= MMAP_THRESHOLD ? realloc_to_map(arena, ptr, size)
+                                        : heap_realloc(arena, ptr, size);
+  unlock_arena(arena);
+  STAT_BLOCK(reallocs, newptr);
+  return newptr;
+}
+
+void *mm_memalign(size_t align, size_t size) {
+  if (align == 0 || (align & (align - 1)) != 0)
+    return NULL;
+  if (align <= ALIGNMENT || size == 0)
+    return mm_malloc(size);
+  void *ptr;
+  if (size >= MMAP_THRESHOLD || align >= MMAP_THRESHOLD - size) {
+    ptr = map_alloc(size, align);
+  } else {
+    Arena *arena = lock_thread_arena(get_tcache());
+    ptr = heap_memalign(arena, align, size);
+    unlock_arena(arena);
+  }
+  STAT_BLOCK(mallocs, ptr);
+  return ptr;
+}
+
+/*
+ * mm_free without reading the block, the cache bin is the one mm_malloc
+ * takes for size. only sizes above SLAB_MAX prove the block is a chunk of
+ * at least that bin, a smaller one may be a slot or a chunk (realloc in
+ * place, memalign) that holds less than ALIGN(size) and goes to mm_free.
+ * size must be the size it was allocated or reallocated with
+ */
+void mm_free_sized(void *ptr, size_t size) {
+  if (ptr == NULL)
+    return;
+
+  int region = mem_region_of(ptr);
+
+#ifdef CHECKHEAP
+  check_free_size(ptr, size, region < 0);
+#endif
+  if (region >= 0 && size <= SLAB_MAX) {
+    mm_free(ptr);
+    return;
+  }
+  STAT_BLOCK(frees, ptr);
+
+  if (region < 0) {
+    map_free(ptr);
+    return;
+  }
+
+  ThreadCache *cache = get_tcache();
+  Arena *arena = &ARENAS[region];
+
+  if (REMOTE_FREE && arena != cache->arena) {
+    push_remote_free(arena, (FreeChunk *)PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr));
+    return;
+  }
+
+  if (TCACHE_COUNT > 0 && size <= TCACHE_MAX) {
+    size_t cap = PAYLOADSIZE_FROM_CHUNKSIZE(CALC_CHUNK_SIZE(size));
+
+    if (cap <= TCACHE_MAX) {
+      int bin = TCACHE_BIN(cap);
+
+      if (cache->count[bin] >= TCACHE_COUNT)
+        tcache_flush(cache, bin, TCACHE_COUNT / 2);
+
+      SET_NEXT_CHUNK((FreeChunk *)PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr),
+                     cache->chunks[bin]);
+      cache->chunks[bin] = (FreeChunk *)PAYLOAD_TO_CHUNKSTRUCT_PTR(ptr);
+      cache->count[bin]++;
+      return;
+    }
+  }
+
+  // only requests of at most SLAB_MAX bytes can be slots
+  lock_arena(arena);
+  heap_free_chunk(arena, ptr);
+  unlock_arena(arena);
+}
+
+/* one lock for the whole batch, the thread cache is bypassed */
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+  size_t done = 0;
+
+  if (size >= MMAP_THRESHOLD) {
+    while (done < n && (out[done] = map_alloc(size, 0)) != NULL)
+      done++;
+  } else {
+    Arena *arena = lock_thread_arena(get_tcache());
+    done = heap_malloc_batch(arena, size, n, out);
+    unlock_arena(arena);
+  }
+#ifdef STATS
+  // the last block of a batch holds the slack
+  for (size_t j = 0; j < done; j++)
+    STAT_BLOCK(mallocs, out[j]);
+#endif
+  return done;
+}
+
+/* sorted by address the chunks of one arena are next to each other */
+void mm_free_batch(void **ptrs, size_t n) {
+  size_t i = 0;
+
+  qsort(ptrs, n, sizeof(void *), compare_ptrs);
+  while (i < n && ptrs[i] == NULL)
+    i++;
+#ifdef STATS
+  for (size_t j = i; j < n; j++)
+    STAT_BLOCK(frees, ptrs[j]);
+#endif
+
+  while (i < n) {
+    int region = mem_region_of(ptrs[i]);
+    size_t start = i;
+
+    if (region < 0) {
+      map_free(ptrs[i++]);
+      continue;
+    }
+
+    while (i < n && mem_region_of(ptrs[i]) == region)
+      i++;
+
+    Arena *arena = &ARENAS[region];
+    lock_arena(arena);
+    heap_free_batch(arena, ptrs + start, i - start);
+    unlock_arena(arena);
+  }
+}
+
+/*
+ * trims the heap of every arena that is in use, the cache of the calling
+ * thread is emptied first
+ */
+int mm_trim(size_t pad) {
+  int trimmed = 0;
+
+  // chunks the calling thread caches could pin the end of a heap
+  ThreadCache *cache = get_tcache();
+  for (int bin = 0; bin < TCACHE_BINS; bin++)
+    tcache_flush(cache, bin, cache->count[bin]);
+
+  for (int i = 0; i < NUM_ARENAS; i++) {
+    Arena *arena = &ARENAS[i];
+
+    pthread_mutex_lock(&arena->lock);
+    if (START != NULL) {
+      slab_release(arena);
+      trimmed |= heap_trim(arena, pad);
+    }
+    unlock_arena(arena);
+  }
+  return trimmed;
+}
+
+/* reserves heap in the arena of the calling thread */
+int mm_reserve(size_t bytes) {
+  Arena *arena = lock_thread_arena(get_tcache());
+  int ret = heap_reserve(arena, bytes);
+  unlock_arena(arena);
+  return ret;
+}
+#else
+/* mapped chunks lie outside of the heap of the only arena */
+#define IS_MAPPED(ptr)                                                         \
+  ((uintptr_t)(ptr) < (uintptr_t)ARENAS[0].start ||                            \
+   (uintptr_t)(ptr) > (uintptr_t)ARENAS[0].end)
+
+int mm_init(void) {
+#ifdef COMPACT_LINKS
+  LINK_BASE = (char *)mem_heap_lo() - sizeof(unsigned);
+  if (!LINKS_FIT())
+    return -1;
+#endif
+#ifdef STATS
+  reset_counters();
+#endif
+  ARENAS[0].region = 0;
+  return heap_init(&ARENAS[0]);
+}
+
+void *mm_malloc(size_t size) {
+  void *ptr = size >= MMAP_THRESHOLD ? map_alloc(size, 0)
+                                     : heap_malloc(&ARENAS[0], size);
+  STAT_BLOCK(mallocs, ptr);
+  return ptr;
+}
+
+void mm_free(void *ptr) {
+  STAT_BLOCK(frees, ptr);
+  if (ptr != NULL && IS_MAPPED(ptr))
+    map_free(ptr);
+  else
+    heap_free(&ARENAS[0], ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size) {
+  if (ptr == NULL)
+    return mm_malloc(size);
+
+  // realloc to 0 bytes is a free
+  if (size == 0)
+    STAT_BLOCK(frees, ptr);
+  void *newptr;
+  if (IS_MAPPED(ptr))
+    newptr = map_realloc(ptr, size);
+  else if (size >= MMAP_THRESHOLD)
+    newptr = realloc_to_map(&ARENAS[0], ptr, size);
+  else
+    newptr = heap_realloc(&ARENAS[0], ptr, size);
+  STAT_BLOCK(reallocs, newptr);
+  return newptr;
+}
+
+void *mm_memalign(size_t align, size_t size) {
+  if (align == 0 || (align & (align - 1)) != 0)
+    return NULL;
+  if (align <= ALIGNMENT || size == 0)
+    return mm_malloc(size);
+  void *ptr = size >= MMAP_THRESHOLD || align >= MMAP_THRESHOLD - size
+                  ? map_alloc(size, align)
+                  : heap_memalign(&ARENAS[0], align, size);
+  STAT_BLOCK(mallocs, ptr);
+  return ptr;
+}
+
 /*
- * mm_free
- *
- * inserts the block into freelist at the first found freeblock
- * checks if coalescing is possible and calls coalesc function
+ * only requests of at most SLAB_MAX bytes can be slots, bigger ones skip
+ * the lookup in SLAB_MAP. size must be the size the block was allocated
+ * or reallocated with
  */
-void mm_free(void *ptr) {
+void mm_free_sized(void *ptr, size_t size) {
+  if (ptr == NULL)
+    return;
 
 #ifdef CHECKHEAP
-  mm_check(__LINE__);
+  check_free_size(ptr, size, IS_MAPPED(ptr));
+#endif
+  STAT_BLOCK(frees, ptr);
+
+  if (IS_MAPPED(ptr))
+    map_free(ptr);
+  else if (size > SLAB_MAX)
+    heap_free_chunk(&ARENAS[0], ptr);
+  else
+    heap_free(&ARENAS[0], ptr);
+}
+
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+  size_t done = 0;
+
+  if (size >= MMAP_THRESHOLD) {
+    while (done < n && (out[done] = map_alloc(size, 0)) != NULL)
+      done++;
+  } else {
+    done = heap_malloc_batch(&ARENAS[0], size, n, out);
+  }
+#ifdef STATS
+  // the last block of a batch holds the slack
+  for (size_t j = 0; j < done; j++)
+    STAT_BLOCK(mallocs, out[j]);
+#endif
+  return done;
+}
+
+/* sorted by address the mapped chunks are in front of and behind the heap */
+void mm_free_batch(void **ptrs, size_t n) {
+  size_t i = 0;
+
+  qsort(ptrs, n, sizeof(void *), compare_ptrs);
+  while (i < n && ptrs[i] == NULL)
+    i++;
+#ifdef STATS
+  for (size_t j = i; j < n; j++)
+    STAT_BLOCK(frees, ptrs[j]);
+#endif
+
+  while (i < n) {
+    size_t start = i;
+
+    if (IS_MAPPED(ptrs[i])) {
+      map_free(ptrs[i++]);
+      continue;
+    }
+
+    while (i < n && !IS_MAPPED(ptrs[i]))
+      i++;
+    heap_free_batch(&ARENAS[0], ptrs + start, i - start);
+  }
+}
+
+int mm_reserve(size_t bytes) { return heap_reserve(&ARENAS[0], bytes); }
+
+int mm_trim(size_t pad) {
+  slab_release(&ARENAS[0]);
+  return heap_trim(&ARENAS[0], pad);
+}
 #endif
 
-  FreeChunk *chunk = (FreeChunk *)CHUNKPTR_TO_CHUNKSTRUCT_PTR(ptr);
-  if (GET_FREEBIT(chunk->header) == 1) {
-    printf("Trying to freeing a non free chunk. Canceling\n");
+/*
+ * ---------------------------------
+ * region arenas
+ *
+ * a region gets blocks from mm_malloc and hands out their memory with a
+ * bump pointer, there is no header per request and no free of a single
+ * request. mm_arena_reset makes all blocks empty again and keeps them for
+ * the next round, only the blocks of big requests are freed.
+ * works the same in both builds, on top of mm_malloc/mm_free
+ * ---------------------------------
+ */
+
+/* start of a block of a region, followed by its memory */
+typedef struct RegionBlock RegionBlock;
+struct RegionBlock {
+  RegionBlock *next;
+};
+
+/* size of the RegionBlock struct in front of the memory of a block */
+#define REGION_HEADER ALIGN(sizeof(RegionBlock))
+
+struct mm_arena {
+  RegionBlock *blocks;  // blocks of block_size bytes, in the order of use
+  RegionBlock *current; // block the bump pointer is in, NULL before the first
+  char *next;           // bump pointer
+  char *limit;          // end of current
+  RegionBlock *big;     // blocks of single big requests
+  size_t block_size;
+};
+
+/*
+ * creates an empty region with blocks of block_size bytes (0 for
+ * ARENA_BLOCK), the first block is taken by the first request
+ * returns NULL if mm_malloc fails
+ */
+mm_arena_t *mm_arena_create(size_t block_size) {
+  mm_arena_t *region = mm_malloc(sizeof(mm_arena_t));
+
+  if (region == NULL)
+    return NULL;
+  if (block_size == 0)
+    block_size = ARENA_BLOCK;
+  if (block_size < 2 * REGION_HEADER)
+    block_size = 2 * REGION_HEADER;
+
+  region->blocks = NULL;
+  region->current = NULL;
+  region->next = NULL;
+  region->limit = NULL;
+  region->big = NULL;
+  region->block_size = ALIGN(block_size);
+  return region;
+}
+
+/*
+ * moves the bump pointer on to the next block, one that a reset emptied
+ * or a new one, or gives a big request a block of its own
+ */
+static void *region_refill(mm_arena_t *region, size_t size) {
+  RegionBlock *block;
+
+  if (size > (region->block_size - REGION_HEADER) / 4) {
+    if (size > SIZE_MAX - REGION_HEADER ||
+        (block = mm_malloc(REGION_HEADER + size)) == NULL)
+      return NULL;
+    block->next = region->big;
+    region->big = block;
+    return (char *)block + REGION_HEADER;
+  }
+
+  block = region->current != NULL ? region->current->next : region->blocks;
+  if (block == NULL) {
+    if ((block = mm_malloc(region->block_size)) == NULL)
+      return NULL;
+    block->next = NULL;
+    if (region->current != NULL)
+      region->current->next = block;
+    else
+      region->blocks = block;
+  }
+
+  region->current = block;
+  region->next = (char *)block + REGION_HEADER + size;
+  region->limit = (char *)block + region->block_size;
+  return (char *)block + REGION_HEADER;
+}
+
+/*
+ * returns size bytes (ALIGNMENT aligned) of the region, NULL for size 0
+ * or if mm_malloc fails. the memory lives until the next reset
+ */
+void *mm_arena_alloc(mm_arena_t *region, size_t size) {
+  if (size == 0 || size > SIZE_MAX - ALIGNMENT)
+    return NULL;
+  size = ALIGN(size);
+
+  if (size <= (size_t)(region->limit - region->next)) {
+    void *ptr = region->next;
+    region->next += size;
+    return ptr;
+  }
+  return region_refill(region, size);
+}
+
+/*
+ * frees everything the region handed out at once, the blocks stay with
+ * the region and are filled again from the first one. only the blocks
+ * of big requests go back to mm_free
+ */
+void mm_arena_reset(mm_arena_t *region) {
+  while (region->big != NULL) {
+    RegionBlock *block = region->big;
+    region->big = block->next;
+    mm_free(block);
+  }
+  region->current = NULL;
+  region->next = NULL;
+  region->limit = NULL;
+}
+
+/* frees the region and all of its blocks */
+void mm_arena_destroy(mm_arena_t *region) {
+  if (region == NULL)
     return;
+
+  mm_arena_reset(region);
+  while (region->blocks != NULL) {
+    RegionBlock *block = region->blocks;
+    region->blocks = block->next;
+    mm_free(block);
   }
+  mm_free(region);
+}
 
-  printf("\n");
+/*
+ * ---------------------------------
+ * handles
+ *
+ * the block of a handle is a chunk of the heap (never a slot or a
+ * mapping) with the handle bit set, the Handle struct is a block of its
+ * arena that never moves. the caller reaches the block only through
+ * mm_hlock, which pins it until mm_hunlock, so mm_compact may move every
+ * block that is not locked. with -DTHREADS the arena of the handle is
+ * locked for every call
+ * ---------------------------------
+ */
 
-  // ---  Insert into free list ---
-  SET_ISFREE(chunk->header);
-  // SET_FOOTER(chunk, chunk->header);
-  FreeChunk *next1 = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(chunk);
-  next1->prev_size = chunk->header;
+/* locks the arena of a handle, its block can not move while it is held */
+static inline void lock_handle(Handle *handle) {
+#ifdef THREADS
+  pthread_mutex_lock(&handle->arena->lock);
+#else
+  (void)handle;
+#endif
+}
 
-  // find next prev free chunk
-  FreeChunk *anker = (FreeChunk *)START;
+static inline void unlock_handle(Handle *handle) {
+#ifdef THREADS
+  pthread_mutex_unlock(&handle->arena->lock);
+#else
+  (void)handle;
+#endif
+}
 
-  anker->next_chunk->prev_chunk = chunk;
-  chunk->next_chunk = anker->next_chunk;
-  anker->next_chunk = chunk;
-  chunk->prev_chunk = anker;
+/*
+ * allocates a block of size bytes that mm_compact may move, returns its
+ * handle or NULL. the block is not locked and always in the heap, so it
+ * can be at most as big as a region
+ */
+mm_handle_t mm_halloc(size_t size) {
+  if (size == 0 || size > CHUNK_MAX_REQUEST - HANDLE_PAD ||
+      size + HANDLE_PAD > mem_max_heapsize())
+    return NULL;
 
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
+#ifdef THREADS
+  Arena *arena = lock_thread_arena(get_tcache());
+#else
+  Arena *arena = &ARENAS[0];
+#endif
+  Handle *handle = heap_malloc(arena, sizeof(Handle));
+  char *payload =
+      handle == NULL ? NULL : heap_malloc_chunk(arena, size + HANDLE_PAD);
+
+  if (payload != NULL) {
+    SET_HANDLEBIT(PAYLOAD_TO_CHUNKSTRUCT_PTR(payload)->header);
+    *(Handle **)payload = handle;
+    handle->ptr = payload + HANDLE_PAD;
+    handle->arena = arena;
+    handle->locks = 0;
+  } else if (handle != NULL) {
+    heap_free(arena, handle);
+    handle = NULL;
+  }
+
+#ifdef THREADS
+  unlock_arena(arena);
 #endif
+  return handle;
+}
 
-  // --- coalescing ---
+/* pins the block of a handle and returns its address, locks nest */
+void *mm_hlock(mm_handle_t handle) {
+  lock_handle(handle);
+  handle->locks++;
+  void *ptr = handle->ptr;
+  unlock_handle(handle);
+  return ptr;
+}
 
-  // coalesc prev
-  if (chunk->prev_size != 1) {
-    if (GET_FREEBIT(chunk->prev_size) == 0) {
-      coalesc((FreeChunk *)JUMP_PREV_FROM_STRUCT(chunk), chunk);
-    }
+/* undoes one mm_hlock, the address it returned is no longer valid */
+void mm_hunlock(mm_handle_t handle) {
+  lock_handle(handle);
+  handle->locks--;
+  unlock_handle(handle);
+}
+
+/* frees the block of a handle and the handle, locked or not */
+void mm_hfree(mm_handle_t handle) {
+  if (handle == NULL)
+    return;
+
+  // the arena of a handle never changes, its block moves until it is locked
+  Arena *arena = handle->arena;
+  lock_handle(handle);
+  char *payload = handle->ptr - HANDLE_PAD;
+  Chunk *chunk = PAYLOAD_TO_CHUNKSTRUCT_PTR(payload);
+
+  CLEAR_HANDLEBIT(chunk->header);
+  if (arena->compact_cursor == chunk)
+    arena->compact_cursor = NULL;
+  heap_free_chunk(arena, payload);
+  heap_free(arena, handle);
+#ifdef THREADS
+  unlock_arena(arena);
+#endif
+}
+
+/*
+ * moves unlocked handle blocks of every arena down until budget bytes were
+ * moved (0 for a whole pass over every heap), each call goes on where the
+ * last one stopped and trims a heap whenever it reaches its end
+ * returns the bytes moved
+ */
+size_t mm_compact(size_t budget) {
+  size_t moved = 0;
+
+  for (int i = 0; i < NUM_ARENAS && (budget == 0 || moved < budget); i++) {
+    Arena *arena = &ARENAS[i];
+
+#ifdef THREADS
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if (START != NULL)
+      moved += heap_compact(arena, budget == 0 ? 0 : budget - moved);
+#ifdef THREADS
+    pthread_mutex_unlock(&arena->lock);
+#endif
   }
+  return moved;
+}
 
+/*
+ * sets the check level of a -DCHECKHEAP build and the period of full
+ * scans with MM_CHECK_EVERY_N (0 keeps it), takes effect at once
+ * returns the level before or -1 if this build can not check at level
+ */
+int mm_set_check(int level, unsigned every) {
 #ifdef CHECKHEAP
-  mm_check(__LINE__);
-#endif
+  int old = CHECK;
 
-  FreeChunk *next = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(chunk);
+  if (level < MM_CHECK_OFF || level > MM_CHECK_FULL)
+    return -1;
+
+  CHECK = level;
+  if (every != 0)
+    CHECK_PERIOD = every;
+  return old;
+#else
+  (void)every;
+  return level == MM_CHECK_OFF ? MM_CHECK_OFF : -1;
+#endif
+}
 
-  // coalesc next
-  if (next < (FreeChunk *)END) {
-    if (GET_FREEBIT(next->header) == 0) {
-      coalesc(chunk, next);
+#ifdef STATS
+/*
+ * adds the chunks of the heap of an arena to stats, slabs count the
+ * bytes of their used slots as used. chunks in a thread cache or quick
+ * list are not free chunks and count as used
+ */
+static void stat_heap(Arena *arena, mm_stats_t *stats) {
+  for (Chunk *chunk = START; chunk != END;
+       chunk = JUMP_NEXT_FROM_STRUCT(chunk)) {
+    size_t size = GET_SIZEBIT(chunk->header);
+
+    stats->heap_bytes += size;
+    if (GET_FREEBIT(chunk->header) == 0) {
+      stats->free_bytes += size;
+      stats->free_chunks[stat_class(PAYLOADSIZE_FROM_CHUNKSIZE(size))]++;
+      if (size > stats->largest_free)
+        stats->largest_free = size;
+    } else if (IS_SLAB(&chunk->payload)) {
+      Slab *slab = SLAB_OF(&chunk->payload);
+      stats->used_bytes += (size_t)slab->used * slab->slot_size;
+    } else {
+      stats->used_bytes += size;
     }
   }
+}
+#endif
+
+/*
+ * fills stats with the counters of all threads since mm_init and the
+ * state of the heaps of all arenas, each arena is locked while it is
+ * walked. returns -1 if this build does not count (-DSTATS)
+ */
+int mm_stats(mm_stats_t *stats) {
+#ifdef STATS
+  memset(stats, 0, sizeof(*stats));
+  sum_counters(&stats->count);
+
+  for (int i = 0; i < NUM_ARENAS; i++) {
+    Arena *arena = &ARENAS[i];
+
+#ifdef THREADS
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if (START != NULL)
+      stat_heap(arena, stats);
+#ifdef THREADS
+    pthread_mutex_unlock(&arena->lock);
+#endif
+  }
+  return 0;
+#else
+  (void)stats;
+  return -1;
+#endif
+}
 
-#ifdef CHECKHEAP
-  mm_check(__LINE__);
+/*
+ * chooses the placement policy of the heaps the next mm_init creates
+ * returns the policy before or -1 if this build does not support policy
+ */
+int mm_set_policy(int policy) {
+  int old = POLICY;
+
+#ifdef TLSF
+  if (policy != MM_FIRST_FIT && policy != MM_ADDRESS_FIT)
+    return -1;
 #endif
+  if (policy < 0 || policy >= MM_POLICIES)
+    return -1;
+
+  POLICY = policy;
+  return old;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * function to print a chunk, the footer is only valid if it is free
  */
-void *mm_realloc(void *ptr, size_t size) {
-  /*
-   * ATTENTION: You do not need to implement realloc for this assignment
-   */
-  void *oldptr = ptr;
-  void *newptr;
-  size_t copySize;
+void print_chunk(Chunk *c) {
+  unsigned footer = JUMP_NEXT_FROM_STRUCT(c)->prev_size;
+  printf("Chunk:\nsize: %u\nfree: %u\nprev: %u\nfsize: %u\nffree: %u\n",
+         GET_SIZEBIT(c->header), GET_FREEBIT(c->header),
+         GET_PREVBIT(c->header) >> 1, GET_SIZEBIT(footer), GET_FREEBIT(footer));
+}
 
-  newptr = mm_malloc(size);
-  if (newptr == NULL)
-    return NULL;
-  copySize = *(size_t *)((char *)oldptr - SIZE_T_SIZE);
-  if (size < copySize)
-    copySize = size;
-  memcpy(newptr, oldptr, copySize);
-  mm_free(oldptr);
-  return newptr;
+#ifndef TLSF
+/*
+ * checks a subtree of the free chunk tree
+ * counts the free chunks in it and returns its black height
+ */
+static int check_tree(TreeChunk *node, TreeChunk *parent, int line_num,
+                      unsigned *count, int *was_error) {
+  if (node == NULL)
+    return 1;
+
+  if (node->parent != parent || PREV_CHUNK(node) != NULL) {
+    *was_error = 1;
+    printf("Line %d: Tree node is not linked correctly\n", line_num);
+  }
+  if (IS_RED(node) && (IS_RED(node->left) || IS_RED(node->right))) {
+    *was_error = 1;
+    printf("Line %d: Red tree node has a red child\n", line_num);
+  }
+  if ((node->left != NULL && TREE_SIZE(node->left) >= TREE_SIZE(node)) ||
+      (node->right != NULL && TREE_SIZE(node->right) <= TREE_SIZE(node))) {
+    *was_error = 1;
+    printf("Line %d: Tree is not ordered by size\n", line_num);
+  }
+
+  for (TreeChunk *same = node; same != NULL; same = NEXT_CHUNK(same)) {
+    (*count)++;
+    if (GET_FREEBIT(same->header) == 1 || TREE_SIZE(same) != TREE_SIZE(node)) {
+      *was_error = 1;
+      printf("Line %d: Chunk in tree list is not free or has another size\n",
+             line_num);
+    }
+  }
+
+  int left = check_tree(node->left, node, line_num, count, was_error);
+  int right = check_tree(node->right, node, line_num, count, was_error);
+  if (left != right) {
+    *was_error = 1;
+    printf("Line %d: Tree is not black balanced\n", line_num);
+  }
+  return left + (node->color == BLACK);
 }
+#endif
 
 /*
- * function to print a chunk
+ * checks that the free slots and counts of a slab add up
  */
-void print_chunk(Chunk c) {
-  unsigned footer = JUMP_NEXT_FROM_STRUCT(&c)->prev_size;
-  printf("Chunk:\nsize: %u\nfree: %u\nfsize: %u\nffree: %u",
-         GET_SIZEBIT(c.header), GET_FREEBIT(c.header), GET_SIZEBIT(footer),
-         GET_FREEBIT(footer));
+static void check_slab(Slab *slab, int line_num, int *was_error) {
+  unsigned free_slots = 0;
+
+  for (void *slot = slab->free_slots; slot != NULL; slot = *(void **)slot) {
+    if (SLAB_OF(slot) != slab || ++free_slots > slab->capacity) {
+      *was_error = 1;
+      printf("Line %d: Free slot is outside of its slab\n", line_num);
+      return;
+    }
+  }
+  if (slab->carved > slab->capacity ||
+      slab->used + free_slots != slab->carved) {
+    *was_error = 1;
+    printf("Line %d: Slab has %u used and %u free of %u carved slots\n",
+           line_num, slab->used, free_slots, slab->carved);
+  }
 }
 
 /*
@@ -468,73 +3491,290 @@ void print_chunk(Chunk c) {
  *
  * is the heapsize the same as the system given heapsize?
  * does traversing the heap using the size end at the correct end?
- * are elements in free list actually free?
+ * does every footer of a free chunk match its header?
+ * does every prev bit match the chunk before?
+ * are there two free chunks next to each other?
+ * are elements in free list actually free and in the right size class?
+ * is the tree of big chunks ordered and balanced?
+ * is every free chunk in a free list?
+ * are the chunks in the quick lists not free and of the right size?
+ * is every slab in the slab map and are its slots counted correctly?
  *
  */
-int mm_check(int line_num) {
+static int check_arena(Arena *arena, int line_num) {
 
   int was_error = 0;
 
-  // printf("\n--------CHECKHEAP---------\n");
-
   Chunk *current = START;
 
   // check if every block added together equals the size of the heap
-  unsigned size = 0;
+  size_t size = 0;
+  unsigned free_in_heap = 0;
+  unsigned free_in_lists = 0;
+  unsigned slabs_in_heap = 0;
+  unsigned slabs_in_map = 0;
+  unsigned prevbit = 0b10;
 
   while (GET_SIZEBIT(current->header) != 0) {
-    // printf("size: %u\n", GET_SIZEBIT(current->header));
-    if (current > (Chunk *)mem_heap_hi()) {
+    if (current > (Chunk *)mem_region_hi(arena->region)) {
+      was_error = 1;
       printf("Line %d: Chunk is outside of heap\n", line_num);
+      break;
+    }
+    if (GET_PREVBIT(current->header) != prevbit) {
+      was_error = 1;
+      printf("Line %d: Prev bit does not match the chunk before\n", line_num);
+    }
+    prevbit = PREVBIT_OF(current->header);
+    if (GET_FREEBIT(current->header) == 0) {
+      free_in_heap++;
+      if (JUMP_NEXT_FROM_STRUCT(current)->prev_size != current->header) {
+        was_error = 1;
+        printf("Line %d: Footer does not match header\n", line_num);
+      }
+      if (GET_PREVBIT(current->header) == 0) {
+        was_error = 1;
+        printf("Line %d: Two free chunks were not coalesced\n", line_num);
+      }
+    } else if (GET_HANDLEBIT(current->header) != 0) {
+      if ((*(Handle **)&current->payload)->ptr !=
+          &current->payload + HANDLE_PAD) {
+        was_error = 1;
+        printf("Line %d: Handle does not point to its block\n", line_num);
+      }
+    } else if (IS_SLAB(&current->payload)) {
+      slabs_in_heap++;
+      if (SLAB_OF(&current->payload) != (Slab *)&current->payload ||
+          GET_SIZEBIT(current->header) != CALC_CHUNK_SIZE(SLAB_SIZE)) {
+        was_error = 1;
+        printf("Line %d: Slab chunk is not one aligned page\n", line_num);
+      } else {
+        check_slab((Slab *)&current->payload, line_num, &was_error);
+      }
     }
-    current = JUMP_NEXT_FROM_STRUCT(current);
     size += GET_SIZEBIT(current->header);
+    current = JUMP_NEXT_FROM_STRUCT(current);
   }
-  size += sizeof(Chunk);
+  size += START_PAD + 2 * sizeof(unsigned);
 
-  if (size != mem_heapsize()) {
-    printf("Line %d: Heapsize(%u) does not match given Heapsize(%zu)\n",
-           line_num, size, mem_heapsize());
+  if (size != mem_region_size(arena->region)) {
+    was_error = 1;
+    printf("Line %d: Heapsize(%zu) does not match given Heapsize(%zu)\n",
+           line_num, size, mem_region_size(arena->region));
   }
-  //
-  // if (((char *)END + sizeof(Chunk)) != mem_heap_hi()) {
-  //   printf("Line %d: END does not equal given Heap End.\n", line_num);
-  // }
 
   if (current != END) {
     was_error = 1;
     printf("Line %d: Traversed current does not equal END.\n", line_num);
+  } else if (GET_PREVBIT(END->header) != prevbit) {
+    was_error = 1;
+    printf("Line %d: Prev bit of END does not match the last chunk\n",
+           line_num);
   }
 
-  FreeChunk *check_free = (FreeChunk *)START;
-
-  while (check_free != (FreeChunk *)END &&
-         GET_FREEBIT(check_free->header) == 1) {
-    check_free = (FreeChunk *)JUMP_NEXT_FROM_STRUCT(check_free);
+  for (int cls = 0; cls < NUM_CLASSES; cls++) {
+#ifdef TLSF
+    if (((FREE_LISTS[cls] != NULL) !=
+         ((SL_BITMAP[cls / SL_COUNT] >> (cls % SL_COUNT)) & 1)) ||
+        ((SL_BITMAP[cls / SL_COUNT] != 0) !=
+         ((FL_BITMAP >> (cls / SL_COUNT)) & 1))) {
+      was_error = 1;
+      printf("Line %d: Bitmap does not match free list %d\n", line_num, cls);
+    }
+#endif
+    for (FreeChunk *check_free = FREE_LISTS[cls]; check_free != NULL;
+         check_free = NEXT_CHUNK(check_free)) {
+      free_in_lists++;
+      if (GET_FREEBIT(check_free->header) == 1) {
+        was_error = 1;
+        printf("Line %d: Chunk in Freelist is not free\n", line_num);
+      }
+      if (size_class(GET_SIZEBIT(check_free->header)) != cls) {
+        was_error = 1;
+        printf("Line %d: Chunk is in the wrong size class\n", line_num);
+      }
+      if (NEXT_CHUNK(check_free) != NULL &&
+          PREV_CHUNK(NEXT_CHUNK(check_free)) != check_free) {
+        was_error = 1;
+        printf("Line %d: Freelist is not doubly linked\n", line_num);
+      }
+      if (arena->policy == MM_ADDRESS_FIT && NEXT_CHUNK(check_free) != NULL &&
+          NEXT_CHUNK(check_free) < check_free) {
+        was_error = 1;
+        printf("Line %d: Freelist is not address ordered\n", line_num);
+      }
+    }
+#ifndef TLSF
+    if (ROVERS[cls] != NULL &&
+        (GET_FREEBIT(ROVERS[cls]->header) == 1 ||
+         size_class(GET_SIZEBIT(ROVERS[cls]->header)) != cls)) {
+      was_error = 1;
+      printf("Line %d: Rover is not a free chunk of its class\n", line_num);
+    }
+#endif
   }
 
-  FreeChunk *anker = check_free;
+#ifndef TLSF
+  if (IS_RED(TREE_ROOT)) {
+    was_error = 1;
+    printf("Line %d: Tree root is red\n", line_num);
+  }
+  check_tree(TREE_ROOT, NULL, line_num, &free_in_lists, &was_error);
+#endif
 
-  if (GET_FREEBIT(check_free->header) == 0) {
-    while (check_free->next_chunk != anker) {
-      if (GET_FREEBIT(check_free->header) == 1) {
+  for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+    for (Slab *slab = SLABS[cls]; slab != NULL; slab = slab->next_slab) {
+      if (slab->slot_size != (cls + 1) * ALIGNMENT ||
+          slab->used >= slab->capacity) {
+        was_error = 1;
+        printf("Line %d: Slab is full or in the wrong class\n", line_num);
+      }
+      if (slab->next_slab != NULL && slab->next_slab->prev_slab != slab) {
         was_error = 1;
-        printf("Line %d: Chunk in forward Freelist is not free\n", line_num);
+        printf("Line %d: Slab list is not doubly linked\n", line_num);
       }
-      check_free = check_free->next_chunk;
     }
+  }
 
-    while (check_free->prev_chunk != anker) {
-      if (GET_FREEBIT(check_free->header) == 1) {
+#ifdef DEFER_COALESCE
+  unsigned in_quick_lists = 0;
+  for (int bin = 0; bin < QUICK_BINS; bin++) {
+    for (FreeChunk *quick = QUICK_LISTS[bin]; quick != NULL;
+         quick = NEXT_CHUNK(quick)) {
+      in_quick_lists++;
+      if (GET_FREEBIT(quick->header) == 0 ||
+          GET_SIZEBIT(quick->header) != bin * ALIGNMENT) {
         was_error = 1;
-        printf("Line %d: Chunk in backwards Freelist is not free\n", line_num);
+        printf("Line %d: Chunk in quick list is free or has another size\n",
+               line_num);
       }
-      check_free = check_free->prev_chunk;
     }
   }
+  if (in_quick_lists != arena->quick_count) {
+    was_error = 1;
+    printf("Line %d: %u chunks in quick lists but quick_count is %u\n",
+           line_num, in_quick_lists, arena->quick_count);
+  }
+#endif
+
+  for (size_t i = 0, used = SLAB_MAP_USED; i < used; i++)
+    slabs_in_map += __builtin_popcount(SLAB_MAP[i]);
+  if (slabs_in_heap != slabs_in_map) {
+    was_error = 1;
+    printf("Line %d: %u slabs in heap but %u in slab map\n", line_num,
+           slabs_in_heap, slabs_in_map);
+  }
+  if (slabs_in_heap != arena->slab_count) {
+    was_error = 1;
+    printf("Line %d: %u slabs in heap but slab_count is %u\n", line_num,
+           slabs_in_heap, arena->slab_count);
+  }
+
+  if (free_in_heap != free_in_lists) {
+    was_error = 1;
+    printf("Line %d: %u free chunks in heap but %u in free lists\n", line_num,
+           free_in_heap, free_in_lists);
+  }
 
   if (was_error == 1) {
     printf("--------END---------\n");
   }
   return 0;
 }
+
+#ifdef CHECKHEAP
+/*
+ * called when an op starts, scans the heap before every op with
+ * MM_CHECK_FULL and before every CHECK_PERIOD-th op of the arena with
+ * MM_CHECK_EVERY_N
+ */
+static void check_op(Arena *arena, int line_num) {
+  if (CHECK == MM_CHECK_FULL ||
+      (CHECK == MM_CHECK_EVERY_N && ++arena->ops >= CHECK_PERIOD)) {
+    arena->ops = 0;
+    check_arena(arena, line_num);
+  }
+}
+
+/* called where a function leaves the heap consistent, MM_CHECK_FULL only */
+static void check_full(Arena *arena, int line_num) {
+  if (CHECK == MM_CHECK_FULL)
+    check_arena(arena, line_num);
+}
+
+/*
+ * MM_CHECK_LOCAL and up: the invariants of one chunk an op touched and of
+ * its neighbours in constant time, the free list links of a free chunk,
+ * but not which list it is in
+ */
+static void check_chunk(Arena *arena, Chunk *chunk, int line_num) {
+  if (CHECK < MM_CHECK_LOCAL)
+    return;
+
+  unsigned size = GET_SIZEBIT(chunk->header);
+
+  if (chunk < START || chunk >= END || size < MIN_CHUNKSIZE ||
+      size % ALIGNMENT != 0 || JUMP_NEXT_FROM_STRUCT(chunk) > END) {
+    printf("Line %d: Chunk %p of size %u is not a chunk of the heap\n",
+           line_num, (void *)chunk, size);
+    return;
+  }
+
+  Chunk *next = JUMP_NEXT_FROM_STRUCT(chunk);
+
+  if (GET_PREVBIT(next->header) != PREVBIT_OF(chunk->header))
+    printf("Line %d: Prev bit of the chunk after %p is wrong\n", line_num,
+           (void *)chunk);
+
+  if (GET_PREVBIT(chunk->header) == 0) {
+    Chunk *prev = JUMP_PREV_FROM_STRUCT(chunk);
+
+    if (prev < START || GET_FREEBIT(prev->header) != 0 ||
+        JUMP_NEXT_FROM_STRUCT(prev) != chunk)
+      printf("Line %d: prev_size of %p does not lead to a free chunk\n",
+             line_num, (void *)chunk);
+  }
+
+  if (GET_FREEBIT(chunk->header) != 0)
+    return;
+
+  FreeChunk *linked = (FreeChunk *)chunk;
+
+  if (next->prev_size != chunk->header)
+    printf("Line %d: Footer of free chunk %p is wrong\n", line_num,
+           (void *)chunk);
+  if (GET_PREVBIT(chunk->header) == 0 || GET_FREEBIT(next->header) == 0)
+    printf("Line %d: Free chunk %p is not coalesced\n", line_num,
+           (void *)chunk);
+  if ((NEXT_CHUNK(linked) != NULL &&
+       PREV_CHUNK(NEXT_CHUNK(linked)) != linked) ||
+      (PREV_CHUNK(linked) != NULL && NEXT_CHUNK(PREV_CHUNK(linked)) != linked))
+    printf("Line %d: Free list links of %p are broken\n", line_num,
+           (void *)chunk);
+}
+
+/*
+ * MM_CHECK_LOCAL and up: the block mm_free_sized frees holds at least size
+ * bytes
+ */
+static void check_free_size(void *ptr, size_t size, int mapped) {
+  if (CHECK < MM_CHECK_LOCAL || ptr == NULL)
+    return;
+
+  size_t holds = block_holds(ptr, mapped);
+  if (holds < size)
+    printf("mm_free_sized of %p: size %zu but the block holds %zu bytes\n",
+           ptr, size, holds);
+}
+#endif
+
+/*
+ * checks the heap of every arena that is in use
+ */
+int mm_check(int line_num) {
+  for (int i = 0; i < NUM_ARENAS; i++) {
+    if (ARENAS[i].start != NULL)
+      check_arena(&ARENAS[i], line_num);
+  }
+  return 0;
+}
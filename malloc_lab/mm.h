@@ -3,7 +3,91 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n); /* sorts ptrs */
+extern int mm_reserve(size_t bytes);
+extern int mm_trim(size_t pad);
+extern int mm_set_policy(int policy);
+extern int mm_set_check(int level, unsigned every);
+
+/*
+ * placement policies of mm_set_policy, they only choose among the free
+ * chunks of less than 1024 bytes (requests of 65 to about 1000 bytes):
+ * smaller requests are slab slots and bigger chunks are always best fit
+ */
+#define MM_FIRST_FIT   0 /* first fit in the size class, newest chunk first */
+#define MM_NEXT_FIT    1 /* first fit from where the last search stopped */
+#define MM_GOOD_FIT    2 /* smallest of the first few chunks that fit */
+#define MM_BEST_FIT    3 /* smallest chunk that fits */
+#define MM_ADDRESS_FIT 4 /* first fit in lists ordered by address, every
+                            free walks its list to insert (O(n)) */
+#define MM_POLICIES    5
+
+/* heap check levels of mm_set_check (builds with -DCHECKHEAP) */
+#define MM_CHECK_OFF     0 /* no checks */
+#define MM_CHECK_LOCAL   1 /* the chunks an op touches and their neighbours */
+#define MM_CHECK_EVERY_N 2 /* and a full scan every n ops */
+#define MM_CHECK_FULL    3 /* and a full scan in every op */
+
+/* size classes of mm_stats: class c counts sizes up to 16 << c bytes */
+#define MM_STAT_CLASSES 16
+
+/* counters of mm_stats (builds with -DSTATS), all unsigned long */
+typedef struct {
+    unsigned long mallocs[MM_STAT_CLASSES];  /* by the payload the block holds */
+    unsigned long reallocs[MM_STAT_CLASSES]; /* the block they return */
+    unsigned long frees[MM_STAT_CLASSES];    /* also realloc to 0 bytes */
+    unsigned long searches;   /* free list searches (first_fit) */
+    unsigned long visited;    /* chunks and tree nodes they visited */
+    unsigned long splits;     /* free chunks cut in two */
+    unsigned long coalesces;  /* chunks merged with a neighbour */
+    unsigned long sbrks;      /* mem_sbrk calls that grow a heap */
+    unsigned long sbrk_bytes;
+    unsigned long trims;      /* mem_sbrk calls that shrink a heap */
+    unsigned long trim_bytes;
+    unsigned long maps;       /* mappings of mapped chunks */
+    unsigned long map_bytes;
+} mm_counters_t;
+
+/* what mm_stats reports */
+typedef struct {
+    mm_counters_t count;      /* of all threads since the last mm_init */
+    /* the heaps of all arenas at the time of the call */
+    size_t heap_bytes;        /* all chunks */
+    size_t used_bytes;        /* allocated chunks and slots */
+    size_t free_bytes;        /* free chunks */
+    size_t largest_free;      /* the biggest free chunk */
+    unsigned long free_chunks[MM_STAT_CLASSES]; /* by payload size */
+} mm_stats_t;
+
+extern int mm_stats(mm_stats_t *stats); /* -1 without -DSTATS */
+
+/*
+ * handles: blocks that mm_compact may move as long as they are not
+ * locked, mm_hlock pins the block and gives its address until mm_hunlock
+ */
+typedef struct mm_handle *mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void *mm_hlock(mm_handle_t handle);
+extern void mm_hunlock(mm_handle_t handle);
+extern void mm_hfree(mm_handle_t handle);
+extern size_t mm_compact(size_t budget); /* bytes to move, 0: a pass */
+
+/*
+ * region arenas: bump pointer allocation from big blocks of mm_malloc,
+ * everything is freed at once by mm_arena_reset or mm_arena_destroy.
+ * not the heap arenas of -DTHREADS, one thread at a time per region
+ */
+typedef struct mm_arena mm_arena_t;
+
+extern mm_arena_t *mm_arena_create(size_t block_size); /* 0: default */
+extern void *mm_arena_alloc(mm_arena_t *region, size_t size);
+extern void mm_arena_reset(mm_arena_t *region);
+extern void mm_arena_destroy(mm_arena_t *region);
 
 
 /* 
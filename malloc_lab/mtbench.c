@@ -0,0 +1,269 @@
+/*
+ * mtbench.c - Multi-threaded benchmark for the thread safe mm.c build
+ *
+ * Every thread runs the same mix of small mm_malloc/mm_free requests
+ * on its own set of slots, so most blocks are freed by the thread that
+ * allocated them. The benchmark is run with 1, 2, 4, ... up to the
+ * maximum number of threads and prints the throughput and the speedup
+ * over a single thread.
+ *
+ * With -p the threads are split into producer/consumer pairs instead.
+ * A producer allocates blocks and hands them to its consumer through a
+ * ring buffer, the consumer frees them. Every mm_free is timed, the
+ * benchmark prints frees per second and the p99 free latency.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define SLOTS      256  /* live blocks per thread */
+#define MAX_SIZE   256  /* largest request in bytes */
+#define RING       1024 /* blocks in flight per producer/consumer pair */
+
+static int num_ops = 1000000; /* requests per thread (set by -n) */
+
+/* Single producer, single consumer ring buffer of one pair */
+typedef struct {
+    char *blocks[RING];
+    unsigned head;       /* next slot the producer writes */
+    unsigned tail;       /* next slot the consumer reads */
+    double *lat;         /* mm_free latency of every block in nsecs */
+} pair_t;
+
+/*
+ * worker - allocate into or free a pseudo random slot on every request
+ */
+static void *worker(void *arg)
+{
+    unsigned seed = (unsigned)(size_t)arg * 2654435761u + 1;
+    char *slots[SLOTS];
+    int i;
+
+    memset(slots, 0, sizeof(slots));
+    for (i = 0; i < num_ops; i++) {
+	int k;
+
+	seed = seed * 1103515245 + 12345;
+	k = (seed >> 16) % SLOTS;
+	if (slots[k] != NULL) {
+	    mm_free(slots[k]);
+	    slots[k] = NULL;
+	}
+	else {
+	    size_t size = 1 + (seed >> 8) % MAX_SIZE;
+	    if ((slots[k] = mm_malloc(size)) == NULL) {
+		fprintf(stderr, "mm_malloc failed\n");
+		exit(1);
+	    }
+	    slots[k][0] = (char)k;
+	}
+    }
+    for (i = 0; i < SLOTS; i++)
+	mm_free(slots[i]);
+    return NULL;
+}
+
+/*
+ * producer - allocate num_ops blocks and pass them to the consumer
+ */
+static void *producer(void *arg)
+{
+    pair_t *pair = arg;
+    unsigned seed = (unsigned)(size_t)arg;
+    int i;
+
+    for (i = 0; i < num_ops; i++) {
+	unsigned head = pair->head;
+	char *p;
+
+	seed = seed * 1103515245 + 12345;
+	if ((p = mm_malloc(1 + (seed >> 8) % MAX_SIZE)) == NULL) {
+	    fprintf(stderr, "mm_malloc failed\n");
+	    exit(1);
+	}
+	p[0] = (char)i;
+
+	while (head - __atomic_load_n(&pair->tail, __ATOMIC_ACQUIRE) == RING)
+	    sched_yield();
+	pair->blocks[head % RING] = p;
+	__atomic_store_n(&pair->head, head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * consumer - free every block the producer passes and time the mm_free
+ */
+static void *consumer(void *arg)
+{
+    pair_t *pair = arg;
+    struct timespec t0, t1;
+    int i;
+
+    for (i = 0; i < num_ops; i++) {
+	unsigned tail = pair->tail;
+	char *p;
+
+	while (__atomic_load_n(&pair->head, __ATOMIC_ACQUIRE) == tail)
+	    sched_yield();
+	p = pair->blocks[tail % RING];
+	__atomic_store_n(&pair->tail, tail + 1, __ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	mm_free(p);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pair->lat[i] = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * run_pairs - run npairs producer/consumer pairs, returns elapsed
+ *     seconds and stores the p99 mm_free latency over all pairs
+ */
+static double run_pairs(int npairs, double *p99)
+{
+    pthread_t prod[npairs], cons[npairs];
+    pair_t *pairs;
+    double *lat;
+    struct timespec t0, t1;
+    int i;
+
+    if ((pairs = calloc(npairs, sizeof(pair_t))) == NULL ||
+	(lat = malloc((size_t)npairs * num_ops * sizeof(double))) == NULL) {
+	fprintf(stderr, "malloc failed in run_pairs\n");
+	exit(1);
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	fprintf(stderr, "mm_init failed\n");
+	exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < npairs; i++) {
+	pairs[i].lat = lat + (size_t)i * num_ops;
+	pthread_create(&prod[i], NULL, producer, &pairs[i]);
+	pthread_create(&cons[i], NULL, consumer, &pairs[i]);
+    }
+    for (i = 0; i < npairs; i++) {
+	pthread_join(prod[i], NULL);
+	pthread_join(cons[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    qsort(lat, (size_t)npairs * num_ops, sizeof(double), cmp_double);
+    *p99 = lat[(size_t)((double)npairs * num_ops * 0.99)];
+
+    free(lat);
+    free(pairs);
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+ * run - run the benchmark with nthreads threads, returns elapsed seconds
+ */
+static double run(int nthreads)
+{
+    pthread_t tid[nthreads];
+    struct timespec t0, t1;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	fprintf(stderr, "mm_init failed\n");
+	exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&tid[i], NULL, worker, (void *)(size_t)i);
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tid[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-hp] [-t <threads>] [-n <ops>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <ops>   Requests per thread.\n");
+    fprintf(stderr, "\t-p         Run producer/consumer pairs.\n");
+    fprintf(stderr, "\t-t <num>   Maximum number of threads.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads;
+    double base = 0;
+    int pairs = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:n:ph")) != EOF) {
+	switch (c) {
+	case 'p':
+	    pairs = 1;
+	    break;
+	case 't':
+	    max_threads = atoi(optarg);
+	    break;
+	case 'n':
+	    num_ops = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    mem_init();
+
+    if (pairs) {
+	printf("%7s%10s%10s%12s\n", "pairs", "secs", "Kfrees/s", "p99 free ns");
+	for (nthreads = 1; nthreads <= (max_threads > 1 ? max_threads / 2 : 1);
+	     nthreads *= 2) {
+	    double p99;
+	    double secs = run_pairs(nthreads, &p99);
+
+	    printf("%7d%10.4f%10.0f%12.0f\n", nthreads, secs,
+		   (double)num_ops * nthreads / 1e3 / secs, p99);
+	}
+	mem_deinit();
+	exit(0);
+    }
+
+    printf("%7s%10s%10s%9s\n", "threads", "secs", "Kops", "speedup");
+    for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+	double secs = run(nthreads);
+	double kops = (double)num_ops * nthreads / 1e3 / secs;
+
+	if (nthreads == 1)
+	    base = kops;
+	printf("%7d%10.4f%10.0f%8.2fx\n", nthreads, secs, kops, kops / base);
+    }
+
+    mem_deinit();
+    exit(0);
+}